@@ -6,5 +6,7 @@
 #include "log.h"
 #include "absolute_difference.hpp"
 #include "iter_swap.hpp"
+#include "morton_code.hpp"
+#include "select.hpp"
 
 #endif //GEOMETRICKS_ALGORITHM_ALL_HPP
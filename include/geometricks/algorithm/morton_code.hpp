@@ -0,0 +1,67 @@
+#ifndef GEOMETRICKS_ALGORITHM_MORTON_CODE_HPP
+#define GEOMETRICKS_ALGORITHM_MORTON_CODE_HPP
+
+//C stdlib includes
+#include <stdint.h>
+
+//C++ stdlib includes
+#include <array>
+#include <cstddef>
+
+/**
+* @file
+* @brief Provides Morton (Z-order) encoding of multidimensional integer coordinates.
+*
+* @details Sorting points by their Morton code places points that are close in space close in the sorted order, which is used to improve the cache behavior
+* of batches of queries.
+*/
+
+namespace geometricks {
+
+  namespace algorithm {
+
+    /**
+    * @brief Number of bits of each coordinate that make it into a 64 bit Morton code of N dimensions.
+    * @details Every dimension gets the same number of bits, with at least 1 bit per dimension. Types with more than 64 dimensions only encode their first 64 dimensions.
+    */
+    template< size_t N >
+    constexpr uint32_t morton_bits_per_dimension = N >= 64 ? 1 : ( N > 2 ? 64 / N : 32 );
+
+    /**
+    @brief Functor that computes the Morton code of a point with integer coordinates.
+    */
+    struct morton_encode_t {
+
+      /**
+      * @brief Interleaves the bits of the coordinates into a single 64 bit key.
+      * @param coordinates The coordinates of the point. Only the lower morton_bits_per_dimension<N> bits of each coordinate are used.
+      * @return The Morton code of the point.
+      * @details Bit b of coordinate d ends up at position b * N + d of the output, so the first coordinate holds the least significant bit of each group.
+      */
+      template< size_t N >
+      constexpr uint64_t
+      operator()( const std::array<uint32_t, N>& coordinates ) const noexcept {
+        constexpr size_t DIMENSIONS = N < 64 ? N : 64;
+        constexpr uint32_t BITS = morton_bits_per_dimension<N>;
+        uint64_t code = 0;
+        for( uint32_t bit = 0; bit < BITS; ++bit ) {
+          for( size_t dimension = 0; dimension < DIMENSIONS; ++dimension ) {
+            code |= static_cast<uint64_t>( ( coordinates[ dimension ] >> bit ) & 1u ) << ( bit * DIMENSIONS + dimension );
+          }
+        }
+        return code;
+      }
+
+    };
+
+    /**
+    @brief Function object for @relatealso morton_encode_t
+    */
+    constexpr auto
+    morton_encode = morton_encode_t{};
+
+  } //namespace algorithm
+
+} //namespace geometricks
+
+#endif //GEOMETRICKS_ALGORITHM_MORTON_CODE_HPP
@@ -0,0 +1,200 @@
+#ifndef GEOMETRICKS_ALGORITHM_SELECT_HPP
+#define GEOMETRICKS_ALGORITHM_SELECT_HPP
+
+//C++ stdlib includes
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <utility>
+
+/**
+* @file
+* @brief Provides selection algorithms, which place the n-th element of a range at its sorted position, as interchangeable function objects.
+*
+* @details Data structures that build by repeatedly splitting on a median, such as geometricks::kd_tree, take one of these as a compile time option.
+*/
+
+namespace geometricks {
+
+  namespace algorithm {
+
+    /**
+    @brief Selection using std::nth_element.
+    */
+    struct nth_element_selection {
+
+      /**
+      * @brief Reorders [ first, last ) so nth holds the element it would hold if the range were sorted, with no greater element before it and no smaller element after it.
+      * @param first Random access iterator to the first element of the range.
+      * @param nth Iterator to the position to select.
+      * @param last Iterator past the last element of the range.
+      * @param comp Compare function.
+      */
+      template< typename RandomAccessIterator, typename Compare >
+      void
+      operator()( RandomAccessIterator first, RandomAccessIterator nth, RandomAccessIterator last, Compare comp ) const {
+        std::nth_element( first, nth, last, comp );
+      }
+
+    };
+
+    /**
+    @brief Selection using the Floyd-Rivest algorithm.
+    @details Before partitioning a large range, the algorithm recursively selects, within a small sample, 2 pivots that bracket the n-th element with high probability,
+    so most elements are only compared against the bracket once and the remaining range shrinks to about n^(2/3) elements. It does fewer comparisons than
+    introselect on average, with a more predictable running time on large ranges. The result satisfies the same postcondition as std::nth_element.
+    @see Floyd and Rivest, "Algorithm 489: The algorithm SELECT - for finding the ith smallest of n elements", Communications of the ACM, 1975.
+    */
+    struct floyd_rivest_selection {
+
+      /**
+      * @brief Reorders [ first, last ) so nth holds the element it would hold if the range were sorted, with no greater element before it and no smaller element after it.
+      * @param first Random access iterator to the first element of the range.
+      * @param nth Iterator to the position to select.
+      * @param last Iterator past the last element of the range.
+      * @param comp Compare function.
+      */
+      template< typename RandomAccessIterator, typename Compare >
+      void
+      operator()( RandomAccessIterator first, RandomAccessIterator nth, RandomAccessIterator last, Compare comp ) const {
+        if( first == last || nth == last ) {
+          return;
+        }
+        __select__( first, nth - first, 0, ( last - first ) - 1, comp );
+      }
+
+    private:
+
+      //Ranges at least this large are bracketed with a sample before partitioning.
+      static constexpr std::ptrdiff_t SAMPLE_THRESHOLD = 600;
+
+      template< typename RandomAccessIterator, typename Compare >
+      static void
+      __select__( RandomAccessIterator first, std::ptrdiff_t k, std::ptrdiff_t left, std::ptrdiff_t right, Compare& comp ) {
+        using std::swap;
+        while( right > left ) {
+          if( right - left > SAMPLE_THRESHOLD ) {
+            double n = static_cast<double>( right - left + 1 );
+            double i = static_cast<double>( k - left + 1 );
+            double z = std::log( n );
+            double s = 0.5 * std::exp( 2.0 * z / 3.0 );
+            double sd = 0.5 * std::sqrt( z * s * ( n - s ) / n ) * ( i < n / 2 ? -1.0 : 1.0 );
+            std::ptrdiff_t new_left = std::max( left, static_cast<std::ptrdiff_t>( static_cast<double>( k ) - i * s / n + sd ) );
+            std::ptrdiff_t new_right = std::min( right, static_cast<std::ptrdiff_t>( static_cast<double>( k ) + ( n - i ) * s / n + sd ) );
+            __select__( first, k, new_left, new_right, comp );
+          }
+          //Partition [ left, right ] around the element at k, which the sampling step placed close to its final position.
+          auto pivot = first[ k ];
+          std::ptrdiff_t i = left;
+          std::ptrdiff_t j = right;
+          swap( first[ left ], first[ k ] );
+          if( comp( pivot, first[ right ] ) ) {
+            swap( first[ right ], first[ left ] );
+          }
+          while( i < j ) {
+            swap( first[ i ], first[ j ] );
+            ++i;
+            --j;
+            while( comp( first[ i ], pivot ) ) {
+              ++i;
+            }
+            while( comp( pivot, first[ j ] ) ) {
+              --j;
+            }
+          }
+          if( !comp( first[ left ], pivot ) && !comp( pivot, first[ left ] ) ) {
+            swap( first[ left ], first[ j ] );
+          }
+          else {
+            ++j;
+            swap( first[ j ], first[ right ] );
+          }
+          if( j <= k ) {
+            left = j + 1;
+          }
+          if( k <= j ) {
+            right = j - 1;
+          }
+        }
+      }
+
+    };
+
+    /**
+    @brief Selection using quickselect with a three-way partition.
+    @details Each step splits the range into the elements smaller than, equal to and greater than a median of 3 pivot, and stops as soon as the n-th position falls
+    among the elements equal to the pivot. On ranges with few distinct keys the equal elements are settled in a single pass instead of being partitioned again
+    and again, so the selection is linear in the size of the range. The result satisfies the same postcondition as std::nth_element, and every element equal to
+    the selected one that ends up before it is adjacent to it.
+    @see Bentley and McIlroy, "Engineering a sort function", Software: Practice and Experience, 1993.
+    */
+    struct three_way_selection {
+
+      /**
+      * @brief Reorders [ first, last ) so nth holds the element it would hold if the range were sorted, with no greater element before it and no smaller element after it.
+      * @param first Random access iterator to the first element of the range.
+      * @param nth Iterator to the position to select.
+      * @param last Iterator past the last element of the range.
+      * @param comp Compare function.
+      */
+      template< typename RandomAccessIterator, typename Compare >
+      void
+      operator()( RandomAccessIterator first, RandomAccessIterator nth, RandomAccessIterator last, Compare comp ) const {
+        using std::swap;
+        if( nth == last ) {
+          return;
+        }
+        while( last - first > SMALL_RANGE ) {
+          auto pivot = __median_of_3__( first[ 0 ], first[ ( last - first ) / 2 ], last[ -1 ], comp );
+          //[ first, less ) < pivot, [ less, current ) == pivot, [ greater, last ) > pivot.
+          RandomAccessIterator less = first;
+          RandomAccessIterator current = first;
+          RandomAccessIterator greater = last;
+          while( current < greater ) {
+            if( comp( *current, pivot ) ) {
+              swap( *less, *current );
+              ++less;
+              ++current;
+            }
+            else if( comp( pivot, *current ) ) {
+              --greater;
+              swap( *current, *greater );
+            }
+            else {
+              ++current;
+            }
+          }
+          if( nth < less ) {
+            last = less;
+          }
+          else if( greater <= nth ) {
+            first = greater;
+          }
+          else {
+            return;
+          }
+        }
+        std::sort( first, last, comp );
+      }
+
+    private:
+
+      //Ranges up to this size are sorted instead.
+      static constexpr std::ptrdiff_t SMALL_RANGE = 16;
+
+      template< typename T, typename Compare >
+      static T
+      __median_of_3__( const T& a, const T& b, const T& c, Compare& comp ) {
+        if( comp( a, b ) ) {
+          return comp( b, c ) ? b : ( comp( a, c ) ? c : a );
+        }
+        return comp( a, c ) ? a : ( comp( b, c ) ? c : b );
+      }
+
+    };
+
+  } //namespace algorithm
+
+} //namespace geometricks
+
+#endif //GEOMETRICKS_ALGORITHM_SELECT_HPP
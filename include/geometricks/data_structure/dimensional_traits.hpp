@@ -5,6 +5,7 @@
 #include <utility>
 #include <tuple>
 #include <array>
+#include <type_traits>
 
 //Project includes
 #include "geometricks/meta/utils.hpp"
@@ -182,14 +183,14 @@ namespace geometricks {
       private:
 
         template< typename T >
-        static auto
+        static constexpr auto
         element_distance( const T& lhs, const T& rhs ) noexcept {
           auto tmp = algorithm::absolute_difference( lhs, rhs );
           return tmp * tmp;
         }
 
         template< size_t... Index >
-        auto
+        constexpr auto
         distance_impl( const auto& lhs, const auto& rhs, std::index_sequence<Index...> ) const noexcept {
           return ( element_distance( dimension::get( lhs, dimension_t<Index>{} ), dimension::get( rhs, dimension_t<Index>{} ) ) + ... );
         }
@@ -197,25 +198,98 @@ namespace geometricks {
       public:
 
         template< typename T, typename U, int Index >
-        auto
+        constexpr auto
         operator()( const T& element, const U& stored, dimension_t<Index> ) const noexcept {
           return element_distance( dimension::get( element, dimension_t<Index>{} ), stored );
         }
 
         template< typename T, int Index >
-        auto
+        constexpr auto
         operator()( const T& element, const T& stored, dimension_t<Index> ) const noexcept {
           return element_distance( dimension::get( element, dimension_t<Index>{} ), dimension::get( stored, dimension_t<Index>{} ) );
         }
 
         template< typename T >
-        auto
+        constexpr auto
         operator()( const T& lhs, const T& rhs ) const noexcept {
           return distance_impl( lhs, rhs, std::make_index_sequence<dimensional_traits<T>::dimensions>{} );
         }
 
       };
 
+      /**
+      * @brief Squared euclidean distance where each dimension is scaled by a weight chosen at runtime.
+      * @tparam N The number of dimensions.
+      * @tparam Weight The type of the weights, which is also the type of the distances.
+      * @details Computes sum( weight[ i ] * ( lhs[ i ] - rhs[ i ] )^2 ). Like geometricks::dimension::euclidean_distance, it exposes the per dimension overloads,
+      * so trees can still prune with the distance to the splitting hyperplane, and the sum is unrolled at compile time. Each dimension reads its weight with a constant index,
+      * and the trees pass the functor by reference through the traversal, so the weights are loaded once and stay in registers.
+      * Arithmetic coordinates are converted to Weight before subtracting, so floating point coordinates keep their fractional part.
+      * Example:
+      * @code{.cpp}
+        geometricks::dimension::weighted_euclidean_distance distance{ std::array<double, 3>{ 1.0, 0.5, 2.0 } };
+        auto [nearest, nearest_distance] = tree.nearest_neighbor( std::make_tuple( 10, 10, 10 ), distance );
+      * @endcode
+      */
+      template< size_t N, typename Weight = double >
+      struct weighted_euclidean_distance {
+
+        /**
+        * @brief Constructs the distance with a weight per dimension.
+        * @param weights The weights. Should be non negative.
+        */
+        constexpr weighted_euclidean_distance( const std::array<Weight, N>& weights ) noexcept: m_weights( weights ) {
+        }
+
+      private:
+
+        std::array<Weight, N> m_weights;
+
+        template< typename T >
+        static constexpr Weight
+        element_distance( const T& lhs, const T& rhs ) noexcept {
+          if constexpr( std::is_arithmetic_v<T> ) {
+            Weight difference = static_cast<Weight>( lhs ) - static_cast<Weight>( rhs );
+            return difference * difference;
+          }
+          else {
+            auto tmp = static_cast<Weight>( algorithm::absolute_difference( lhs, rhs ) );
+            return tmp * tmp;
+          }
+        }
+
+        template< typename T, size_t... Index >
+        constexpr Weight
+        distance_impl( const T& lhs, const T& rhs, std::index_sequence<Index...> ) const noexcept {
+          return ( ( m_weights[ Index ] * element_distance( dimension::get( lhs, dimension_t<Index>{} ), dimension::get( rhs, dimension_t<Index>{} ) ) ) + ... );
+        }
+
+      public:
+
+        template< typename T, typename U, int Index >
+        constexpr Weight
+        operator()( const T& element, const U& stored, dimension_t<Index> ) const noexcept {
+          return m_weights[ Index ] * element_distance( dimension::get( element, dimension_t<Index>{} ), stored );
+        }
+
+        template< typename T, int Index >
+        constexpr Weight
+        operator()( const T& element, const T& stored, dimension_t<Index> ) const noexcept {
+          return m_weights[ Index ] * element_distance( dimension::get( element, dimension_t<Index>{} ), dimension::get( stored, dimension_t<Index>{} ) );
+        }
+
+        template< typename T >
+        constexpr Weight
+        operator()( const T& lhs, const T& rhs ) const noexcept {
+          static_assert( dimensional_traits<T>::dimensions == N, "The number of weights should match the number of dimensions." );
+          return distance_impl( lhs, rhs, std::make_index_sequence<N>{} );
+        }
+
+      };
+
+      template< typename Weight, size_t N >
+      weighted_euclidean_distance( const std::array<Weight, N>& ) -> weighted_euclidean_distance<N, Weight>;
+
     } //namespace dimension
 
     /**
@@ -237,6 +311,41 @@ namespace geometricks {
       template< typename Functor, typename T, typename U >
       constexpr bool has_value_compare = meta::is_valid_expression_v<compare_value, Functor, T, U>;
 
+      //Distance between 2 points considering only dimension I. Picks the most specific overload supplied by the distance function.
+      template< int I, typename DistanceFunction, typename T >
+      constexpr auto
+      dimension_distance( DistanceFunction& f, const T& lhs, const T& rhs ) {
+        if constexpr( has_dimension_compare<DistanceFunction, T, T, I> ) {
+          return f( lhs, rhs, dimension::dimension_v<I> );
+        }
+        else if constexpr( has_dimension_compare<DistanceFunction, T, dimension::type_at<T, I>, I> ) {
+          return f( lhs, dimension::get( rhs, dimension::dimension_v<I> ), dimension::dimension_v<I> );
+        }
+        else if constexpr( has_dimension_compare<DistanceFunction, dimension::type_at<T, I>, T, I> ) {
+          return f( dimension::get( lhs, dimension::dimension_v<I> ), rhs, dimension::dimension_v<I> );
+        }
+        else if constexpr( has_dimension_compare<DistanceFunction, dimension::type_at<T, I>, dimension::type_at<T, I>, I> ) {
+          return f( dimension::get( lhs, dimension::dimension_v<I> ), dimension::get( rhs, dimension::dimension_v<I> ), dimension::dimension_v<I> );
+        }
+        else {
+          static_assert( has_value_compare<DistanceFunction, dimension::type_at<T, I>, dimension::type_at<T, I>>, "Please supply a dimension compare, a value, value, dimension compare or a value compare." );
+          return f( dimension::get( lhs, dimension::dimension_v<I> ), dimension::get( rhs, dimension::dimension_v<I> ) );
+        }
+      }
+
+      template< typename Function, int... Is >
+      constexpr void
+      __dispatch_dimension_impl__( int dimension, Function& f, std::integer_sequence<int, Is...> ) {
+        ( void )( ( dimension == Is ? ( f( std::integral_constant<int, Is>{} ), true ) : false ) || ... );
+      }
+
+      //Calls f with std::integral_constant<int, dimension>, turning a dimension known at runtime into a compile time one.
+      template< int Dimensions, typename Function >
+      constexpr void
+      dispatch_dimension( int dimension, Function&& f ) {
+        __dispatch_dimension_impl__( dimension, f, std::make_integer_sequence<int, Dimensions>{} );
+      }
+
     }
     /**
     * @endcond
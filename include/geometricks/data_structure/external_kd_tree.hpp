@@ -0,0 +1,524 @@
+#ifndef GEOMETRICKS_DATA_STRUCTURE_EXTERNAL_KD_TREE_HPP
+#define GEOMETRICKS_DATA_STRUCTURE_EXTERNAL_KD_TREE_HPP
+
+//C stdlib includes
+#include <stdint.h>
+#include <stdlib.h>
+
+//C++ stdlib includes
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+//POSIX includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//Project includes
+#include "kd_tree.hpp"
+#include "dimensional_traits.hpp"
+
+/**
+* @file Implements an external memory kd tree builder and a kd tree backed by a memory mapped file.
+*/
+
+namespace geometricks {
+
+  /**
+  * @cond EXCLUDE_DOXYGEN
+  *
+  * Internal not to be documented
+  */
+  namespace __detail__ {
+
+    //Builds the implicit kd tree array of a file by recursively partitioning it into smaller files, until each subtree fits in the memory budget.
+    template< typename T, typename Compare >
+    struct __external_kd_tree_builder__ : private Compare {
+
+      __external_kd_tree_builder__( const std::string& input_path, const std::string& output_path, size_t memory_budget, Compare comp ): Compare( comp ),
+                                                                                                                                      m_output_path( output_path ),
+                                                                                                                                      m_memory_budget( memory_budget ),
+                                                                                                                                      m_chunk_elements( std::max<size_t>( memory_budget / ( 8 * sizeof( T ) ), 1 ) ),
+                                                                                                                                      m_sample_elements( std::max<size_t>( memory_budget / ( 4 * sizeof( T ) ), 16 ) ),
+                                                                                                                                      m_generator( 0x6b64u ) {
+        std::ifstream input( input_path, std::ios::binary | std::ios::ate );
+        if( !input ) {
+          throw std::runtime_error( "Could not open " + input_path + " to build a kd tree." );
+        }
+        int64_t count = static_cast<int64_t>( input.tellg() ) / static_cast<int64_t>( sizeof( T ) );
+        m_output.open( output_path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc );
+        if( !m_output ) {
+          throw std::runtime_error( "Could not open " + output_path + " to write a kd tree." );
+        }
+        m_pending.push_back( run_t{ input_path, false, 0, count, 0 } );
+      }
+
+      void
+      build() {
+        //Runs are processed in FIFO order, so the tree is partitioned one level at a time.
+        while( !m_pending.empty() ) {
+          run_t run = m_pending.front();
+          m_pending.pop_front();
+          int dimension = run.m_depth % DATA_DIMENSIONS;
+          dispatch_dimension<DATA_DIMENSIONS>( dimension, [ & ]( auto current_dimension ) {
+            constexpr int Dimension = decltype( current_dimension )::value;
+            if( static_cast<size_t>( run.m_count ) * sizeof( T ) <= m_memory_budget ) {
+              __build_in_memory__<Dimension>( run );
+            }
+            else {
+              __partition__<Dimension>( run );
+            }
+          } );
+          if( run.m_temporary ) {
+            std::remove( run.m_path.c_str() );
+          }
+        }
+        m_output.flush();
+        if( !m_output ) {
+          throw std::runtime_error( "Could not write the kd tree to " + m_output_path + "." );
+        }
+      }
+
+    private:
+
+      static constexpr int DATA_DIMENSIONS = dimension::dimensional_traits<T>::dimensions;
+
+      //A run holds the elements of the subtree that goes to [ m_start, m_start + m_count ) of the output array.
+      struct run_t {
+
+        std::string m_path;
+
+        bool m_temporary;
+
+        int64_t m_start;
+
+        int64_t m_count;
+
+        int32_t m_depth;
+
+      };
+
+      struct __run_writer__ {
+
+        __run_writer__( const std::string& path, size_t buffer_elements ): m_stream( path, std::ios::binary | std::ios::trunc ) {
+          if( !m_stream ) {
+            throw std::runtime_error( "Could not create the temporary file " + path + "." );
+          }
+          m_buffer.reserve( buffer_elements );
+        }
+
+        void
+        push( const T& element ) {
+          m_buffer.push_back( element );
+          if( m_buffer.size() == m_buffer.capacity() ) {
+            flush();
+          }
+        }
+
+        void
+        flush() {
+          m_stream.write( reinterpret_cast<const char*>( m_buffer.data() ), m_buffer.size() * sizeof( T ) );
+          m_buffer.clear();
+          if( !m_stream ) {
+            throw std::runtime_error( "Could not write a temporary file of the kd tree build." );
+          }
+        }
+
+        std::ofstream m_stream;
+
+        std::vector<T> m_buffer;
+
+      };
+
+      std::string m_output_path;
+
+      std::fstream m_output;
+
+      size_t m_memory_budget;
+
+      size_t m_chunk_elements;
+
+      size_t m_sample_elements;
+
+      std::mt19937_64 m_generator;
+
+      std::deque<run_t> m_pending;
+
+      int64_t m_run_counter = 0;
+
+      template< int Dimension >
+      bool
+      __less__( const T& left, const T& right ) const {
+        return Compare::operator()( dimension::get( left, dimension::dimension_v<Dimension> ), dimension::get( right, dimension::dimension_v<Dimension> ) );
+      }
+
+      template< typename Function >
+      void
+      __for_each__( const run_t& run, Function&& f ) {
+        std::ifstream input( run.m_path, std::ios::binary );
+        std::vector<T> buffer( std::min<size_t>( m_chunk_elements, static_cast<size_t>( run.m_count ) ) );
+        int64_t remaining = run.m_count;
+        while( remaining > 0 ) {
+          size_t read_count = std::min<size_t>( buffer.size(), static_cast<size_t>( remaining ) );
+          input.read( reinterpret_cast<char*>( buffer.data() ), read_count * sizeof( T ) );
+          if( !input ) {
+            throw std::runtime_error( "Could not read " + run.m_path + " while building a kd tree." );
+          }
+          for( size_t i = 0; i < read_count; ++i ) {
+            f( buffer[ i ] );
+          }
+          remaining -= read_count;
+        }
+      }
+
+      void
+      __write_output__( int64_t index, const T* elements, size_t count ) {
+        m_output.seekp( index * static_cast<int64_t>( sizeof( T ) ) );
+        m_output.write( reinterpret_cast<const char*>( elements ), count * sizeof( T ) );
+      }
+
+      //Same layout as the kd_tree constructor. Each median ends up at its final position, so the block is turned into the subtree in place.
+      template< int Dimension >
+      void
+      __build_in_place__( T* first, int64_t blocksize ) {
+        if( blocksize > 1 ) {
+          constexpr int NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
+          int64_t step = blocksize >> 1;
+          std::nth_element( first, first + step, first + blocksize, [ this ]( const T& left, const T& right ) {
+            return __less__<Dimension>( left, right );
+          } );
+          __build_in_place__<NextDimension>( first, step );
+          __build_in_place__<NextDimension>( first + step + 1, blocksize - step - 1 );
+        }
+      }
+
+      template< int Dimension >
+      void
+      __build_in_memory__( const run_t& run ) {
+        std::vector<T> elements;
+        elements.reserve( run.m_count );
+        __for_each__( run, [ & ]( const T& element ) {
+          elements.push_back( element );
+        } );
+        __build_in_place__<Dimension>( elements.data(), run.m_count );
+        __write_output__( run.m_start, elements.data(), elements.size() );
+      }
+
+      //Finds an element whose value in Dimension is the rank-th smallest of the run, without loading the run. Elements are narrowed to a bracket ( lower, upper ]
+      //of values around the rank, guessed from a random sample, until the bracket fits in memory.
+      template< int Dimension >
+      T
+      __select__( const run_t& run, int64_t rank ) {
+        T lower{};
+        T upper{};
+        bool has_lower = false;
+        bool has_upper = false;
+        auto in_bracket = [ & ]( const T& element ) {
+          return ( !has_lower || __less__<Dimension>( lower, element ) ) && ( has_upper ? !__less__<Dimension>( upper, element ) : true );
+        };
+        std::vector<T> sample;
+        while( true ) {
+          //First pass: count the bracket, find its smallest value and sample it.
+          sample.clear();
+          int64_t count = 0;
+          int64_t minimum_count = 0;
+          T minimum{};
+          T maximum{};
+          __for_each__( run, [ & ]( const T& element ) {
+            if( !in_bracket( element ) ) {
+              return;
+            }
+            if( count == 0 || __less__<Dimension>( element, minimum ) ) {
+              minimum = element;
+              minimum_count = 0;
+            }
+            if( !__less__<Dimension>( minimum, element ) ) {
+              ++minimum_count;
+            }
+            if( count == 0 || __less__<Dimension>( maximum, element ) ) {
+              maximum = element;
+            }
+            ++count;
+            if( sample.size() < m_sample_elements ) {
+              sample.push_back( element );
+            }
+            else {
+              uint64_t position = std::uniform_int_distribution<uint64_t>{ 0, static_cast<uint64_t>( count - 1 ) }( m_generator );
+              if( position < sample.size() ) {
+                sample[ position ] = element;
+              }
+            }
+          } );
+          if( rank < minimum_count || !__less__<Dimension>( minimum, maximum ) ) {
+            return minimum;
+          }
+          if( static_cast<size_t>( count ) * sizeof( T ) <= m_memory_budget / 2 ) {
+            std::vector<T>().swap( sample );
+            std::vector<T> elements;
+            elements.reserve( count );
+            __for_each__( run, [ & ]( const T& element ) {
+              if( in_bracket( element ) ) {
+                elements.push_back( element );
+              }
+            } );
+            std::nth_element( elements.begin(), elements.begin() + rank, elements.end(), [ this ]( const T& left, const T& right ) {
+              return __less__<Dimension>( left, right );
+            } );
+            return elements[ rank ];
+          }
+          //Pick new bounds a few standard deviations around the expected position of the rank in the sample.
+          std::sort( sample.begin(), sample.end(), [ this ]( const T& left, const T& right ) {
+            return __less__<Dimension>( left, right );
+          } );
+          int64_t sample_size = static_cast<int64_t>( sample.size() );
+          int64_t position = static_cast<int64_t>( static_cast<double>( rank ) / count * sample_size );
+          int64_t margin = std::max<int64_t>( 1, static_cast<int64_t>( 3 * std::sqrt( static_cast<double>( sample_size ) ) ) );
+          bool has_new_lower = position - margin >= 0;
+          bool has_new_upper = position + margin < sample_size;
+          T new_lower = has_new_lower ? sample[ position - margin ] : T{};
+          T new_upper = has_new_upper ? sample[ position + margin ] : T{};
+          //Second pass: count how many elements of the bracket fall below, inside and above the new bounds.
+          int64_t below = 0;
+          int64_t inside = 0;
+          __for_each__( run, [ & ]( const T& element ) {
+            if( !in_bracket( element ) ) {
+              return;
+            }
+            if( has_new_lower && !__less__<Dimension>( new_lower, element ) ) {
+              ++below;
+            }
+            else if( !has_new_upper || !__less__<Dimension>( new_upper, element ) ) {
+              ++inside;
+            }
+          } );
+          if( rank < below && below < count ) {
+            upper = new_lower;
+            has_upper = true;
+          }
+          else if( rank >= below && rank < below + inside && inside < count ) {
+            if( has_new_lower ) {
+              lower = new_lower;
+              has_lower = true;
+            }
+            if( has_new_upper ) {
+              upper = new_upper;
+              has_upper = true;
+            }
+            rank -= below;
+          }
+          else if( rank >= below + inside ) {
+            lower = new_upper;
+            has_lower = true;
+            rank -= below + inside;
+          }
+          else {
+            //Heavy duplicates can stop the sample bounds from shrinking the bracket. Dropping the smallest value always does, since the rank is past it.
+            lower = minimum;
+            has_lower = true;
+            rank -= minimum_count;
+          }
+        }
+      }
+
+      template< int Dimension >
+      void
+      __partition__( const run_t& run ) {
+        int64_t step = run.m_count >> 1;
+        T median = __select__<Dimension>( run, step );
+        int64_t less_count = 0;
+        __for_each__( run, [ & ]( const T& element ) {
+          less_count += __less__<Dimension>( element, median );
+        } );
+        //Elements equal to the median fill the left run up to step elements, then one of them becomes the node and the rest go right.
+        int64_t equal_to_left = step - less_count;
+        bool node_written = false;
+        run_t left{ __temporary_path__(), true, run.m_start, step, run.m_depth + 1 };
+        run_t right{ __temporary_path__(), true, run.m_start + step + 1, run.m_count - step - 1, run.m_depth + 1 };
+        {
+          __run_writer__ left_writer{ left.m_path, m_chunk_elements };
+          __run_writer__ right_writer{ right.m_path, m_chunk_elements };
+          __for_each__( run, [ & ]( const T& element ) {
+            if( __less__<Dimension>( element, median ) ) {
+              left_writer.push( element );
+            }
+            else if( __less__<Dimension>( median, element ) ) {
+              right_writer.push( element );
+            }
+            else if( equal_to_left > 0 ) {
+              left_writer.push( element );
+              --equal_to_left;
+            }
+            else if( !node_written ) {
+              __write_output__( run.m_start + step, &element, 1 );
+              node_written = true;
+            }
+            else {
+              right_writer.push( element );
+            }
+          } );
+          left_writer.flush();
+          right_writer.flush();
+        }
+        for( auto* child : { &left, &right } ) {
+          if( child->m_count > 0 ) {
+            m_pending.push_back( *child );
+          }
+          else {
+            std::remove( child->m_path.c_str() );
+          }
+        }
+      }
+
+      std::string
+      __temporary_path__() {
+        return m_output_path + ".run" + std::to_string( m_run_counter++ );
+      }
+
+    };
+
+    //Allocator of the kd tree owned by a mapped_kd_tree. The mapped array is released by the mapped_kd_tree, anything else the tree allocates goes to malloc.
+    struct __mapping_allocator__ {
+
+      void* allocate( size_t size ) {
+        return ::malloc( size );
+      }
+
+      void deallocate( void* ptr ) {
+        if( ptr != m_mapping ) {
+          ::free( ptr );
+        }
+      }
+
+      void* m_mapping;
+
+    };
+
+  }
+  /**
+  * @endcond
+  */
+
+  /**
+  * @brief Builds the array of a geometricks::kd_tree in a file, using a bounded amount of memory.
+  * @tparam T The stored data type. Should be trivially copyable, since the elements are read and written as raw bytes.
+  * @param input_path Path of a file holding the input points as a raw array of T.
+  * @param output_path Path of the file that receives the tree, as a raw array of T with the same layout as the array of a geometricks::kd_tree built from the same points.
+  * @param memory_budget Approximate number of bytes of memory the build may use. Should hold at least a few thousand elements.
+  * @param comp Compare function to use for the kd tree. If not supplied, default constructs it.
+  * @details Subtrees that fit in the budget are loaded and built in memory. Larger ones are never loaded: the median of the splitting dimension is found with a few
+  * streaming passes that narrow a bracket of values around it using a random sample, then the subtree is split into 2 temporary files, one per child, next to the output file.
+  * Subtrees are processed level by level and the temporary files of a subtree are deleted once its children were split.
+  * Peak disk usage is roughly 3 times the size of the input.
+  * @throws std::runtime_error If a file can't be read or written.
+  * @see geometricks::mapped_kd_tree to query the output file.
+  */
+  template< typename T, typename Compare = std::less<> >
+  void
+  build_kd_tree_file( const std::string& input_path, const std::string& output_path, size_t memory_budget, Compare comp = Compare{} ) {
+    static_assert( std::is_trivially_copyable_v<T>, "Files of kd trees store raw bytes, so T should be trivially copyable." );
+    __detail__::__external_kd_tree_builder__<T, Compare> builder{ input_path, output_path, memory_budget, comp };
+    builder.build();
+  }
+
+  /**
+  * @brief kd tree whose array is a memory mapped file, such as the ones written by geometricks::build_kd_tree_file.
+  * @tparam T The stored data type. Should be trivially copyable.
+  * @tparam Compare Compare function of the tree. Should be the one used to build the file.
+  * @tparam Traits Compile time configuration of the tree. See geometricks::kd_tree_traits.
+  * @details The file is mapped read only and queried through a regular geometricks::kd_tree, so every query of kd_tree is available and only the pages touched by the
+  * queries are ever read from disk. Only available on POSIX systems.
+  * @note geometricks::kd_tree indexes points with int32_t, so a file can hold at most 2^31 - 1 points. Larger datasets should be split into several files.
+  */
+  template< typename T,
+            typename Compare = std::less<>,
+            typename Traits = kd_tree_traits >
+  struct mapped_kd_tree {
+
+    /**
+    * @brief Maps a kd tree file.
+    * @param path Path of the file.
+    * @param comp Compare function to use for the kd tree. If not supplied, default constructs it.
+    * @throws std::runtime_error If the file can't be mapped or has too many points.
+    */
+    explicit mapped_kd_tree( const std::string& path, Compare comp = Compare{} ): m_length( 0 ),
+                                                                                  m_allocator{ __map__( path, m_length ) },
+                                                                                  m_tree( adopt_layout, static_cast<T*>( m_allocator.m_mapping ), static_cast<int32_t>( m_length / sizeof( T ) ), comp, m_allocator ) {
+    }
+
+    mapped_kd_tree( const mapped_kd_tree& ) = delete;
+
+    mapped_kd_tree& operator=( const mapped_kd_tree& ) = delete;
+
+    ~mapped_kd_tree() {
+      if( m_allocator.m_mapping != nullptr ) {
+        ::munmap( m_allocator.m_mapping, m_length );
+      }
+    }
+
+    /**
+    * @brief Returns the kd tree over the mapped file.
+    */
+    const kd_tree<T, Compare, Traits>&
+    tree() const noexcept {
+      return m_tree;
+    }
+
+    const kd_tree<T, Compare, Traits>*
+    operator->() const noexcept {
+      return &m_tree;
+    }
+
+  private:
+
+    static_assert( std::is_trivially_copyable_v<T>, "Files of kd trees store raw bytes, so T should be trivially copyable." );
+
+    size_t m_length;
+
+    __detail__::__mapping_allocator__ m_allocator;
+
+    kd_tree<T, Compare, Traits> m_tree;
+
+    static void*
+    __map__( const std::string& path, size_t& length ) {
+      int descriptor = ::open( path.c_str(), O_RDONLY );
+      if( descriptor < 0 ) {
+        throw std::runtime_error( "Could not open the kd tree file " + path + "." );
+      }
+      struct stat file_status;
+      if( ::fstat( descriptor, &file_status ) != 0 ) {
+        ::close( descriptor );
+        throw std::runtime_error( "Could not read the size of the kd tree file " + path + "." );
+      }
+      length = static_cast<size_t>( file_status.st_size );
+      if( length / sizeof( T ) > static_cast<size_t>( std::numeric_limits<int32_t>::max() ) ) {
+        ::close( descriptor );
+        throw std::runtime_error( "The kd tree file " + path + " has more points than a kd_tree can index." );
+      }
+      void* mapping = nullptr;
+      if( length > 0 ) {
+        mapping = ::mmap( nullptr, length, PROT_READ, MAP_SHARED, descriptor, 0 );
+        if( mapping == MAP_FAILED ) {
+          ::close( descriptor );
+          throw std::runtime_error( "Could not map the kd tree file " + path + "." );
+        }
+      }
+      ::close( descriptor );
+      return mapping;
+    }
+
+  };
+
+}
+
+#endif //GEOMETRICKS_DATA_STRUCTURE_EXTERNAL_KD_TREE_HPP
@@ -0,0 +1,357 @@
+#ifndef GEOMETRICKS_DATA_STRUCTURE_KD_FOREST_HPP
+#define GEOMETRICKS_DATA_STRUCTURE_KD_FOREST_HPP
+
+//C stdlib includes
+#include <stdint.h>
+
+//C++ stdlib includes
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+//Project includes
+#include "dimensional_traits.hpp"
+#include "geometricks/meta/utils.hpp"
+
+/**
+* @file Implements a forest of randomized kd trees for approximate nearest neighbor search in high dimensions.
+*/
+
+namespace geometricks {
+
+  /**
+  * @brief Compile time configuration of geometricks::kd_forest.
+  * @details To change one of the values, derive from this struct and shadow the value.
+  */
+  struct kd_forest_traits {
+
+    ///Each node splits on a dimension picked at random among this many dimensions with the highest variance.
+    static constexpr int top_variance_dimensions = 5;
+
+    ///Maximum number of points of a node used to estimate the variance of each dimension.
+    static constexpr int variance_sample_size = 128;
+
+  };
+
+  /**
+  * @brief Forest of randomized kd trees for approximate nearest neighbor search.
+  * @tparam T The stored data type. Every dimension of T should be arithmetic.
+  * @tparam Traits Compile time configuration of the forest. See geometricks::kd_forest_traits.
+  * @details Past a couple dozen dimensions a single kd tree has to visit most of its nodes to find the exact nearest neighbor. This structure builds several kd trees
+  * over the same points, where each node splits on a dimension picked at random among the ones with the highest variance, so each tree partitions the space differently.
+  * Queries descend all trees and then keep exploring the most promising unexplored branch of any tree, kept in a single priority queue shared by all trees, until a
+  * given number of points was checked. The number of checks trades recall for latency.
+  *
+  * The points are stored once. Each tree only stores a permutation of the point indices and the split dimension of each node, using the same implicit array layout
+  * as geometricks::kd_tree.
+  * @see Silpa-Anan and Hartley, "Optimised KD-trees for fast image descriptor matching", CVPR 2008.
+  * @see Muja and Lowe, "Fast Approximate Nearest Neighbors with Automatic Algorithm Configuration", VISAPP 2009.
+  */
+  template< typename T,
+            typename Traits = kd_forest_traits >
+  struct kd_forest {
+
+    /**
+    * @brief Constructs a forest with a range of elements.
+    * @param begin Iterator to first element of the input range.
+    * @param end Iterator to the last element of the input range or sentinel value.
+    * @param tree_count Number of randomized trees to build.
+    * @param seed Seed of the random number generator used to pick split dimensions.
+    * @note Complexity: @b O(tree_count * n log n)
+    */
+    template< typename InputIterator, typename Sentinel >
+    kd_forest( InputIterator begin, Sentinel end, int32_t tree_count = 4, uint32_t seed = 0 ): m_points( begin, end ),
+                                                                                                 m_trees( std::max( tree_count, 1 ) ) {
+      std::mt19937 generator{ seed };
+      for( auto& tree : m_trees ) {
+        tree.m_indices.resize( m_points.size() );
+        tree.m_split_dimension.resize( m_points.size() );
+        std::iota( tree.m_indices.begin(), tree.m_indices.end(), 0 );
+        __build__( tree, 0, static_cast<int32_t>( m_points.size() ), generator );
+      }
+    }
+
+    /**
+    * @brief Finds an approximate nearest neighbor of an input point.
+    * @param point The input point to query.
+    * @param max_checks Number of points whose distance is computed before the search stops. Higher values give better recall.
+    * @param f Point distance function object. See geometricks::kd_tree::nearest_neighbor.
+    * @return A pair containing the nearest point found and its distance to the input point.
+    * @pre The forest is not empty.
+    */
+    template< typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    nearest_neighbor( const T& point, int32_t max_checks, DistanceFunction f = DistanceFunction{} ) const {
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      auto output_col = __search__( point, 1, max_checks, f );
+      return std::pair<const T&, distance_t>( m_points[ output_col[ 0 ].first ], output_col[ 0 ].second );
+    }
+
+    /**
+    * @brief Finds approximate k nearest neighbors of an input point.
+    * @param point The input point to query.
+    * @param K the number of desired output points.
+    * @param max_checks Number of points whose distance is computed before the search stops. Higher values give better recall.
+    * @param f Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @return A vector containing the output points as well as the distance calculated from the input point, in ascending order.
+    */
+    template< typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    k_nearest_neighbor( const T& point, uint32_t K, int32_t max_checks, DistanceFunction f = DistanceFunction{} ) const ->
+    std::vector<std::pair<T, std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>>> {
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      auto results = __search__( point, K, max_checks, f );
+      std::vector<std::pair<T, distance_t>> output_col;
+      output_col.reserve( results.size() );
+      for( auto& [ index, distance ] : results ) {
+        output_col.emplace_back( m_points[ index ], distance );
+      }
+      return output_col;
+    }
+
+    /**
+    * @brief Returns the number of points stored in the forest.
+    */
+    int32_t
+    size() const noexcept {
+      return static_cast<int32_t>( m_points.size() );
+    }
+
+    /**
+    * @brief Returns the number of trees of the forest.
+    */
+    int32_t
+    tree_count() const noexcept {
+      return static_cast<int32_t>( m_trees.size() );
+    }
+
+  private:
+
+    static constexpr int DATA_DIMENSIONS = dimension::dimensional_traits<T>::dimensions;
+
+    static_assert( DATA_DIMENSIONS < 65536 );
+
+    struct node_t {
+
+      int32_t m_index;
+
+      int32_t m_block_size;
+
+      operator bool() const {
+        return m_block_size;
+      }
+
+    };
+
+    struct tree_t {
+
+      std::vector<int32_t> m_indices;
+
+      std::vector<uint16_t> m_split_dimension;
+
+    };
+
+    std::vector<T> m_points;
+
+    std::vector<tree_t> m_trees;
+
+    template< size_t I >
+    static double
+    __coordinate_at__( const T& point ) {
+      static_assert( std::is_arithmetic_v<dimension::type_at<T, I>>, "kd_forest needs arithmetic coordinates." );
+      return static_cast<double>( dimension::get( point, dimension::dimension_v<I> ) );
+    }
+
+    template< size_t... Is >
+    static constexpr std::array<double( * )( const T& ), DATA_DIMENSIONS>
+    __make_coordinate_table__( std::index_sequence<Is...> ) {
+      return { { &__coordinate_at__<Is>... } };
+    }
+
+    //Reading a dimension known only at runtime goes through a table, so it costs the same for the first and the last dimension.
+    static double
+    __coordinate__( const T& point, int dimension ) {
+      static constexpr auto table = __make_coordinate_table__( std::make_index_sequence<DATA_DIMENSIONS>{} );
+      return table[ dimension ]( point );
+    }
+
+    template< typename DistanceFunction, size_t I >
+    static auto
+    __dimension_distance_at__( DistanceFunction& f, const T& lhs, const T& rhs ) {
+      return __detail__::dimension_distance<I>( f, lhs, rhs );
+    }
+
+    template< typename DistanceFunction, typename DistanceType, size_t... Is >
+    static constexpr std::array<DistanceType( * )( DistanceFunction&, const T&, const T& ), DATA_DIMENSIONS>
+    __make_distance_table__( std::index_sequence<Is...> ) {
+      return { { &__dimension_distance_at__<DistanceFunction, Is>... } };
+    }
+
+    static node_t
+    __root__( int32_t size ) {
+      return { size >> 1, size };
+    }
+
+    static node_t
+    __left_child__( node_t node ) {
+      int32_t count_left = node.m_block_size >> 1;
+      int32_t index_left = ( node.m_index - ( count_left >> 1 ) - ( count_left & 1 ) );
+      return { index_left, count_left };
+    }
+
+    static node_t
+    __right_child__( node_t node ) {
+      int32_t count_right = ( node.m_block_size >> 1 ) - !( node.m_block_size & 1 );
+      int32_t index_right = ( node.m_index + ( count_right >> 1 ) + 1 );
+      return { index_right, count_right };
+    }
+
+    //Builds the subtree stored in [ start, start + blocksize ) of the tree arrays. The node goes in the middle of the block, like in geometricks::kd_tree.
+    void
+    __build__( tree_t& tree, int32_t start, int32_t blocksize, std::mt19937& generator ) {
+      if( blocksize == 0 ) {
+        return;
+      }
+      int32_t step = blocksize >> 1;
+      int32_t insert_index = start + step;
+      int dimension = 0;
+      if( blocksize > 1 ) {
+        dimension = __choose_split_dimension__( tree.m_indices.data() + start, blocksize, generator );
+        auto less_function = [ this, dimension ]( int32_t left, int32_t right ) {
+          return __coordinate__( m_points[ left ], dimension ) < __coordinate__( m_points[ right ], dimension );
+        };
+        std::nth_element( tree.m_indices.begin() + start, tree.m_indices.begin() + insert_index, tree.m_indices.begin() + start + blocksize, less_function );
+      }
+      tree.m_split_dimension[ insert_index ] = static_cast<uint16_t>( dimension );
+      __build__( tree, start, step, generator );
+      __build__( tree, insert_index + 1, blocksize - step - 1, generator );
+    }
+
+    int
+    __choose_split_dimension__( const int32_t* indices, int32_t blocksize, std::mt19937& generator ) const {
+      int32_t sample_size = std::min<int32_t>( blocksize, Traits::variance_sample_size );
+      int32_t stride = blocksize / sample_size;
+      std::array<double, DATA_DIMENSIONS> mean{};
+      std::array<double, DATA_DIMENSIONS> variance{};
+      for( int32_t i = 0; i < sample_size; ++i ) {
+        const T& point = m_points[ indices[ i * stride ] ];
+        for( int d = 0; d < DATA_DIMENSIONS; ++d ) {
+          mean[ d ] += __coordinate__( point, d );
+        }
+      }
+      for( auto& value : mean ) {
+        value /= sample_size;
+      }
+      for( int32_t i = 0; i < sample_size; ++i ) {
+        const T& point = m_points[ indices[ i * stride ] ];
+        for( int d = 0; d < DATA_DIMENSIONS; ++d ) {
+          double difference = __coordinate__( point, d ) - mean[ d ];
+          variance[ d ] += difference * difference;
+        }
+      }
+      std::array<int, DATA_DIMENSIONS> dimensions;
+      std::iota( dimensions.begin(), dimensions.end(), 0 );
+      constexpr int CANDIDATES = std::min( Traits::top_variance_dimensions, DATA_DIMENSIONS );
+      static_assert( CANDIDATES > 0 );
+      std::partial_sort( dimensions.begin(), dimensions.begin() + CANDIDATES, dimensions.end(), [ &variance ]( int left, int right ) {
+        return variance[ left ] > variance[ right ];
+      } );
+      return dimensions[ std::uniform_int_distribution<int>{ 0, CANDIDATES - 1 }( generator ) ];
+    }
+
+    template< typename DistanceType >
+    struct __branch__ {
+
+      DistanceType m_bound;
+
+      int32_t m_tree;
+
+      node_t m_node;
+
+      bool operator<( const __branch__& rhs ) const {
+        //Inverted so std::priority_queue gives us the closest branch first.
+        return rhs.m_bound < m_bound;
+      }
+
+    };
+
+    //Returns the indices of the best points found along with their distances, in ascending order.
+    template< typename DistanceFunction >
+    auto
+    __search__( const T& point, uint32_t K, int32_t max_checks, DistanceFunction& f ) const {
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      static constexpr auto distance_table = __make_distance_table__<DistanceFunction, distance_t>( std::make_index_sequence<DATA_DIMENSIONS>{} );
+      auto heap_compare = []( const std::pair<int32_t, distance_t>& lhs, const std::pair<int32_t, distance_t>& rhs ) {
+        return lhs.second < rhs.second;
+      };
+      std::vector<std::pair<int32_t, distance_t>> results;
+      results.reserve( K + 1 );
+      std::priority_queue<__branch__<distance_t>> branches;
+      int32_t checks = 0;
+      auto worst_distance = [ & ]() {
+        return results.size() < K ? meta::numeric_limits<distance_t>::max() : results.front().second;
+      };
+      auto check_point = [ & ]( int32_t index ) {
+        ++checks;
+        distance_t distance = f( point, m_points[ index ] );
+        if( distance < worst_distance() ) {
+          //The same point is found by several trees, so make sure it only enters the result once.
+          for( auto& result : results ) {
+            if( result.first == index ) {
+              return;
+            }
+          }
+          results.emplace_back( index, distance );
+          std::push_heap( results.begin(), results.end(), heap_compare );
+          if( results.size() > K ) {
+            std::pop_heap( results.begin(), results.end(), heap_compare );
+            results.pop_back();
+          }
+        }
+      };
+      auto descend = [ & ]( int32_t tree_index, node_t node, distance_t bound ) {
+        const tree_t& tree = m_trees[ tree_index ];
+        while( node ) {
+          int32_t index = tree.m_indices[ node.m_index ];
+          check_point( index );
+          int dimension = tree.m_split_dimension[ node.m_index ];
+          bool go_left = __coordinate__( point, dimension ) < __coordinate__( m_points[ index ], dimension );
+          node_t near_child = go_left ? __left_child__( node ) : __right_child__( node );
+          node_t far_child = go_left ? __right_child__( node ) : __left_child__( node );
+          if( far_child ) {
+            distance_t far_bound = std::max( bound, distance_table[ dimension ]( f, point, m_points[ index ] ) );
+            if( far_bound < worst_distance() ) {
+              branches.push( { far_bound, tree_index, far_child } );
+            }
+          }
+          node = near_child;
+        }
+      };
+      if( K == 0 || m_points.empty() ) {
+        return results;
+      }
+      for( int32_t tree_index = 0; tree_index < static_cast<int32_t>( m_trees.size() ); ++tree_index ) {
+        descend( tree_index, __root__( size() ), distance_t{} );
+      }
+      while( !branches.empty() && checks < max_checks ) {
+        auto branch = branches.top();
+        branches.pop();
+        if( !( branch.m_bound < worst_distance() ) ) {
+          break;
+        }
+        descend( branch.m_tree, branch.m_node, branch.m_bound );
+      }
+      std::sort_heap( results.begin(), results.end(), heap_compare );
+      return results;
+    }
+
+  };
+
+}
+
+#endif //GEOMETRICKS_DATA_STRUCTURE_KD_FOREST_HPP
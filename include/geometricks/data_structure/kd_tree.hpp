@@ -7,11 +7,21 @@
 #include <algorithm>
 #include <queue>
 #include <vector>
+#include <atomic>
+#include <array>
+#include <limits>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <bitset>
 
 //Project includes
 #include "dimensional_traits.hpp"
 #include "geometricks/meta/utils.hpp"
 #include "geometricks/memory/allocator.hpp"
+#include "geometricks/algorithm/morton_code.hpp"
+#include "geometricks/algorithm/select.hpp"
 #include "internal/small_vector.hpp"
 
 /**
@@ -20,12 +30,324 @@
 
 namespace geometricks {
 
+  /**
+  * @brief Counters describing the work done by a single kd tree query.
+  * @details Pass an instance of this struct as the last argument of geometricks::kd_tree::nearest_neighbor, geometricks::kd_tree::k_nearest_neighbor
+  * or geometricks::kd_tree::range_search to find out how much of the tree a query had to touch. The counters are accumulated, so the same instance can be reused
+  * across many queries issued by the same thread. To aggregate counters across threads, see geometricks::kd_tree_shared_statistics.
+  * Queries that don't receive a statistics object don't pay for any of the bookkeeping.
+  *
+  * Example:
+  * @code{.cpp}
+    geometricks::kd_tree_statistics stats;
+    auto [nearest, distance] = tree.nearest_neighbor( std::make_tuple( 10, 10, 10 ), geometricks::dimension::euclidean_distance{}, stats );
+    //stats.nodes_visited now contains the number of nodes the query visited.
+  * @endcode
+  */
+  struct kd_tree_statistics {
+
+    ///Number of tree nodes visited by the queries.
+    int64_t nodes_visited = 0;
+
+    ///Number of point to point distance evaluations.
+    int64_t distance_evaluations = 0;
+
+    ///Number of child subtrees discarded without being visited.
+    int64_t subtrees_pruned = 0;
+
+    ///Deepest recursion level reached, with the root being level 1.
+    int32_t max_depth = 0;
+
+    ///Number of points returned by the queries.
+    int64_t result_count = 0;
+
+    void
+    on_visit( int32_t depth ) noexcept {
+      ++nodes_visited;
+      max_depth = std::max( max_depth, depth );
+    }
+
+    void
+    on_distance_evaluation() noexcept {
+      ++distance_evaluations;
+    }
+
+    void
+    on_prune() noexcept {
+      ++subtrees_pruned;
+    }
+
+    void
+    on_result( int64_t count ) noexcept {
+      result_count += count;
+    }
+
+    kd_tree_statistics&
+    operator+=( const kd_tree_statistics& rhs ) noexcept {
+      nodes_visited += rhs.nodes_visited;
+      distance_evaluations += rhs.distance_evaluations;
+      subtrees_pruned += rhs.subtrees_pruned;
+      max_depth = std::max( max_depth, rhs.max_depth );
+      result_count += rhs.result_count;
+      return *this;
+    }
+
+  };
+
+  /**
+  * @brief Thread safe counterpart of geometricks::kd_tree_statistics.
+  * @details Can be passed directly to the query functions of geometricks::kd_tree from many threads at once, or fed per query geometricks::kd_tree_statistics
+  * objects with operator+=, which is cheaper since each counter is only touched once per query.
+  * All counters use relaxed atomic operations, so they are only meant to be read once the queries are done.
+  */
+  struct kd_tree_shared_statistics {
+
+    std::atomic<int64_t> nodes_visited{ 0 };
+
+    std::atomic<int64_t> distance_evaluations{ 0 };
+
+    std::atomic<int64_t> subtrees_pruned{ 0 };
+
+    std::atomic<int32_t> max_depth{ 0 };
+
+    std::atomic<int64_t> result_count{ 0 };
+
+    void
+    on_visit( int32_t depth ) noexcept {
+      nodes_visited.fetch_add( 1, std::memory_order_relaxed );
+      __update_max_depth__( depth );
+    }
+
+    void
+    on_distance_evaluation() noexcept {
+      distance_evaluations.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    void
+    on_prune() noexcept {
+      subtrees_pruned.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    void
+    on_result( int64_t count ) noexcept {
+      result_count.fetch_add( count, std::memory_order_relaxed );
+    }
+
+    kd_tree_shared_statistics&
+    operator+=( const kd_tree_statistics& rhs ) noexcept {
+      nodes_visited.fetch_add( rhs.nodes_visited, std::memory_order_relaxed );
+      distance_evaluations.fetch_add( rhs.distance_evaluations, std::memory_order_relaxed );
+      subtrees_pruned.fetch_add( rhs.subtrees_pruned, std::memory_order_relaxed );
+      __update_max_depth__( rhs.max_depth );
+      result_count.fetch_add( rhs.result_count, std::memory_order_relaxed );
+      return *this;
+    }
+
+    /**
+    * @brief Returns a plain copy of the counters.
+    */
+    kd_tree_statistics
+    snapshot() const noexcept {
+      kd_tree_statistics ret;
+      ret.nodes_visited = nodes_visited.load( std::memory_order_relaxed );
+      ret.distance_evaluations = distance_evaluations.load( std::memory_order_relaxed );
+      ret.subtrees_pruned = subtrees_pruned.load( std::memory_order_relaxed );
+      ret.max_depth = max_depth.load( std::memory_order_relaxed );
+      ret.result_count = result_count.load( std::memory_order_relaxed );
+      return ret;
+    }
+
+  private:
+
+    void
+    __update_max_depth__( int32_t depth ) noexcept {
+      int32_t current = max_depth.load( std::memory_order_relaxed );
+      while( current < depth && !max_depth.compare_exchange_weak( current, depth, std::memory_order_relaxed ) );
+    }
+
+  };
+
+  /**
+  * @brief Tag type selecting the geometricks::kd_tree constructor that adopts an array already laid out as a kd tree.
+  */
+  struct adopt_layout_t {};
+
+  /**
+  * @brief Tag value for @relatealso adopt_layout_t
+  */
+  constexpr adopt_layout_t adopt_layout{};
+
+  /**
+  * @brief Index of a point stored in a geometricks::kd_tree that is likely close to the next query, used to warm start geometricks::kd_tree::nearest_neighbor.
+  */
+  struct nearest_neighbor_hint {
+
+    ///Index of the point, as returned by geometricks::kd_tree::index_of. Indices outside of [ 0, size() ) are ignored.
+    int32_t index;
+
+  };
+
+  /**
+  * @brief Compile time configuration of geometricks::kd_tree.
+  * @details To change one of the values, derive from this struct and shadow the value, so the remaining ones keep their defaults.
+  * Example:
+  * @code{.cpp}
+    struct prefetching_traits : geometricks::kd_tree_traits {
+      static constexpr int prefetch_depth = 2;
+    };
+    geometricks::kd_tree<std::tuple<float, float, float>, std::less<>, prefetching_traits> tree{ input_vector.begin(), input_vector.end() };
+  * @endcode
+  */
+  struct kd_tree_traits {
+
+    /**
+    * @brief How many levels below the current node are prefetched during nearest neighbor, k nearest neighbor and range traversals.
+    * @details Since the tree is stored as an implicit array, the addresses of the children of a node are known before the query decides which branch to take.
+    * With a value of N, every visited node issues prefetches for its 2^N descendants N levels below, so the far child and the upcoming levels are already on their
+    * way to the cache when the traversal gets to them. 0 disables prefetching. Values of 1 or 2 are usually the best fit for trees that don't fit in the last level cache,
+    * while small trees are better served by the default.
+    */
+    static constexpr int prefetch_depth = 0;
+
+    /**
+    * @brief Monoid whose value is precomputed for every subtree at build time, enabling geometricks::kd_tree::range_aggregate. void disables it.
+    * @details The monoid is default constructed and should expose a value_type, an identity() function returning the neutral value, a lift( const T& ) function turning
+    * a stored point into a value and a combine( value_type, value_type ) function that should be associative and commutative. The tree stores one value_type per point.
+    * Example:
+    * @code{.cpp}
+      struct count_monoid {
+        using value_type = int64_t;
+        value_type identity() const { return 0; }
+        value_type lift( const std::tuple<int, int, int>& ) const { return 1; }
+        value_type combine( value_type lhs, value_type rhs ) const { return lhs + rhs; }
+      };
+      struct counting_traits : geometricks::kd_tree_traits {
+        using aggregate_monoid = count_monoid;
+      };
+    * @endcode
+    */
+    using aggregate_monoid = void;
+
+    /**
+    * @brief Selection algorithm placing the median of each block at its position during construction.
+    * @details Construction selects the median of every node among the points of its subtree, which dominates the build time. The selection has to be exact, since
+    * the implicit layout derives the position of every subtree from the sizes of its siblings. geometricks::algorithm::floyd_rivest_selection brackets the median
+    * within a small sample before partitioning, which needs fewer comparisons than std::nth_element on large blocks. geometricks::algorithm::three_way_selection groups
+    * the points equal to the pivot in a single pass, which is the fastest choice when some dimensions only take a handful of distinct values.
+    * @see geometricks::algorithm::nth_element_selection, geometricks::algorithm::floyd_rivest_selection and geometricks::algorithm::three_way_selection.
+    */
+    using split_selection = algorithm::nth_element_selection;
+
+    /**
+    * @brief Size under which the construction of subtrees is deferred until a query first enters them. 0 builds the whole tree in the constructor.
+    * @details With a positive value, the constructor copies the points and only partitions the top levels of the tree, down to the first level whose subtrees hold
+    * at most this many points. Each of those subtrees is finished, in place, by the first query that descends into it, under a std::once_flag, so concurrent queries
+    * are safe. Trees that are queried in a small region, or rebuilt more often than they are fully explored, skip most of the build work. Until then, the
+    * points of an unbuilt subtree are stored in an unspecified order, so geometricks::kd_tree::operator[] only follows the final layout for indices returned
+    * by queries. Copying a lazy tree finishes it first. Can't be combined with aggregate_monoid, whose values are computed at build time.
+    */
+    static constexpr int32_t lazy_subtree_size = 0;
+
+  };
+
+  /**
+  * @cond EXCLUDE_DOXYGEN
+  *
+  * Internal not to be documented
+  */
+  namespace __detail__ {
+
+    inline void
+    __prefetch__( const void* address ) noexcept {
+#if defined( __GNUC__ ) || defined( __clang__ )
+      __builtin_prefetch( address, 0, 3 );
+#else
+      ( void ) address;
+#endif
+    }
+
+    //Used by queries that weren't given a statistics object. Every hook is empty so the bookkeeping compiles away.
+    struct __no_statistics__ {
+
+      constexpr void on_visit( int32_t ) const noexcept {}
+
+      constexpr void on_distance_evaluation() const noexcept {}
+
+      constexpr void on_prune() const noexcept {}
+
+      constexpr void on_result( int64_t ) const noexcept {}
+
+    };
+
+    //Stands in for the aggregate type of trees that don't store aggregates.
+    struct __no_aggregate__ {};
+
+    template< typename Monoid >
+    struct __aggregate_value__ {
+      using type = typename Monoid::value_type;
+    };
+
+    template<>
+    struct __aggregate_value__<void> {
+      using type = __no_aggregate__;
+    };
+
+    //Dimension masks of partial range searches. Dimensions that aren't constrained are never compared.
+    template< int... Dimensions >
+    struct __static_dimension_mask__ {
+
+      template< int I >
+      static constexpr bool
+      is_constrained() noexcept {
+        return ( ( I == Dimensions ) || ... );
+      }
+
+    };
+
+    template< size_t N >
+    struct __runtime_dimension_mask__ {
+
+      template< int I >
+      bool
+      is_constrained() const noexcept {
+        return m_constrained[ I ];
+      }
+
+      std::bitset<N> m_constrained;
+
+    };
+
+    //Used by queries that weren't given a filter predicate.
+    struct __accept_all__ {
+
+      template< typename T >
+      constexpr bool operator()( const T& ) const noexcept {
+        return true;
+      }
+
+    };
+
+    template< typename Statistics >
+    using __statistics_expr__ = decltype( std::declval<Statistics&>().on_visit( 0 ),
+                                          std::declval<Statistics&>().on_distance_evaluation(),
+                                          std::declval<Statistics&>().on_prune(),
+                                          std::declval<Statistics&>().on_result( 0 ) );
+
+    template< typename Statistics >
+    constexpr bool is_kd_tree_statistics = meta::is_valid_expression_v<__statistics_expr__, Statistics>;
+
+  }
+  /**
+  * @endcond
+  */
+
   /**
   * @brief Cache friendly kd tree data structure
   * @tparam T The stored data type.
   * @tparam Compare Function that compares all the different data types stored in each dimension of the data so we can build the tree.
   * If the stored data type T is a std::tuple<int, std::string, float>, the function should be able to compare ( int, int ), ( std::string, std::string ),
   * ( float, float ) so we can work on all different dimensions.
+  * @tparam Traits Compile time configuration of the tree. See geometricks::kd_tree_traits.
   * @details This kd tree is stored as an array in memory. This gives better cache locality than node based kd trees. The elements are stored in the nodes.
   * Since it is extremely hard to balance a kd tree and it hurts performance to build a new one in each element insertion, insertion opperations are not allowed.
   * @see geometricks::dimension::dimensional_traits and @ref geometricks::dimension::get_t "geometricks::dimension::get" for a guide on how to use this struct with user defined types.
@@ -35,11 +357,15 @@ namespace geometricks {
   * @todo Add threshold neighbors to find all elements below threshold distance to efficiently implement collision detection algorithms. Maybe?
   */
   template< typename T,
-            typename Compare = std::less<> >
+            typename Compare = std::less<>,
+            typename Traits = kd_tree_traits >
   struct kd_tree : private Compare {
 
   private:
 
+    template< typename DistanceFunction >
+    using __distance_t__ = std::decay_t<decltype( std::declval<DistanceFunction&>()( std::declval<T>(), std::declval<T>() ) )>;
+
     struct __heap_compare__ {
       template< typename DistanceType >
       constexpr bool operator()( const std::pair<T*, DistanceType>& lhs, const std::pair<T*, DistanceType>& rhs ) const noexcept {
@@ -68,8 +394,12 @@ namespace geometricks {
     kd_tree( InputIterator begin, Sentinel end, Compare comp = Compare{}, geometricks::allocator alloc = geometricks::allocator{} ): Compare( comp ),
                                                                                                                   m_allocator( alloc ),
                                                                                                                   m_size( std::distance( begin, end ) ),
-                                                                                                                  m_data_array( ( T* ) m_allocator.allocate( sizeof( T ) * m_size ) ) {
-      __construct_kd_tree__<0>( begin, end, 0, m_size );
+                                                                                                                  m_capacity( m_size ),
+                                                                                                                  m_data_array( ( T* ) m_allocator.allocate( sizeof( T ) * m_size ) ),
+                                                                                                                  m_aggregate_array( __allocate_aggregates__( m_size ) ),
+                                                                                                                  m_buffers( __allocate_buffers__() ) {
+      __construct__( begin, end, m_size );
+      __build_aggregates__();
     }
 
     /**
@@ -88,9 +418,36 @@ namespace geometricks {
     template< typename InputIterator, typename Sentinel >
     kd_tree( InputIterator begin, Sentinel end, geometricks::default_compare_t comp, geometricks::allocator alloc = geometricks::allocator{} ):   m_allocator( alloc ),
                                                                                                                                       m_size( std::distance( begin, end ) ),
-                                                                                                                                      m_data_array( ( T* ) m_allocator.allocate( sizeof( T ) * m_size ) ) {
+                                                                                                                                      m_capacity( m_size ),
+                                                                                                                                      m_data_array( ( T* ) m_allocator.allocate( sizeof( T ) * m_size ) ),
+                                                                                                                                      m_aggregate_array( __allocate_aggregates__( m_size ) ),
+                                                                                                                                      m_buffers( __allocate_buffers__() ) {
       ( void ) comp; //Silence warnings and errors.
-      __construct_kd_tree__<0>( begin, end, 0, m_size );
+      __construct__( begin, end, m_size );
+      __build_aggregates__();
+    }
+
+    /**
+    * @brief Constructs a kd tree over an array that is already laid out as a kd tree, without copying or reordering it.
+    * @param tag Placeholder selecting this constructor. See geometricks::adopt_layout.
+    * @param data The array. It should have the layout produced by the other constructors for a tree of the same size, Compare and T, such as a file written
+    * by geometricks::build_kd_tree_file.
+    * @param size Number of elements in data.
+    * @param comp Compare function to use for the kd tree. If not supplied, default constructs it.
+    * @param alloc Memory allocator to use. The tree takes ownership of data, destroying its elements and deallocating it with alloc when destroyed.
+    * @details Copies of the tree don't share data but get their own copy of it, since data may be tied to the lifetime of something else than the tree,
+    * such as the mapping of a geometricks::mapped_kd_tree.
+    * @note Complexity: @b O(1), or @b O(n) when Traits enables aggregates.
+    */
+    kd_tree( adopt_layout_t tag, T* data, int32_t size, Compare comp = Compare{}, geometricks::allocator alloc = geometricks::allocator{} ): Compare( comp ),
+                                                                                                                                        m_allocator( alloc ),
+                                                                                                                                        m_size( size ),
+                                                                                                                                        m_capacity( size ),
+                                                                                                                                        m_data_array( data ),
+                                                                                                                                        m_aggregate_array( __allocate_aggregates__( m_size ) ),
+                                                                                                                                        m_buffers( __allocate_buffers__( true ) ) {
+      ( void ) tag; //Silence warnings and errors.
+      __build_aggregates__();
     }
 
     //Copy constructor
@@ -98,15 +455,30 @@ namespace geometricks {
     /**
     * @brief Copy constructs a kd tree.
     * @param rhs Right hand side of the copy operation.
-    * @param alloc Memory allocator to use. Defaults to the default allocator. See also geometricks::allocator
-    * @details Performs a deep copy of the right hand side parameter.
-    * @note Complexity: @b O(n)
+    * @param alloc Memory allocator to use for the buffers this tree allocates later on. Defaults to the default allocator. See also geometricks::allocator
+    * @details The copy shares the points of rhs instead of copying them. The shared buffers are reference counted, released by the last tree using them with
+    * the allocator that created them, and never written to while shared: geometricks::kd_tree::rebuild and assignment give the tree its own buffers first.
+    * Copies can be made and destroyed concurrently, from any number of threads. Trees built over an adopted array are deep copied with alloc instead,
+    * see geometricks::adopt_layout_t.
+    * @note Complexity: @b O(1), or @b O(n) the first time a tree with deferred subtrees is copied, since they are built first. See kd_tree_traits::lazy_subtree_size.
+    * @b O(n) for adopted arrays.
     */
     kd_tree( const kd_tree& rhs, geometricks::allocator alloc = geometricks::allocator{} ):   Compare( rhs ),
                                                                                                           m_allocator( alloc ),
                                                                                                           m_size( rhs.m_size ),
-                                                                                                          m_data_array( ( T* ) m_allocator.allocate( sizeof( T ) * m_size ) ) {
-      std::copy( rhs.m_data_array, rhs.m_data_array + m_size, m_data_array );
+                                                                                                          m_capacity( rhs.m_capacity ),
+                                                                                                          m_data_array( rhs.m_data_array ),
+                                                                                                          m_aggregate_array( rhs.m_aggregate_array ),
+                                                                                                          m_buffers( rhs.__share__() ),
+                                                                                                          m_lower_corner( rhs.m_lower_corner ),
+                                                                                                          m_upper_corner( rhs.m_upper_corner ) {
+      if( m_buffers != nullptr && m_buffers->m_adopted ) {
+        __release__();
+        __reserve__( rhs.m_size );
+        std::uninitialized_copy( rhs.m_data_array, rhs.m_data_array + rhs.m_size, m_data_array );
+        __copy_aggregates__( rhs );
+        m_size = rhs.m_size;
+      }
     }
 
     //Move constructor
@@ -121,8 +493,16 @@ namespace geometricks {
     kd_tree( kd_tree&& rhs ): Compare( std::move( rhs ) ),
                                           m_allocator( rhs.m_allocator ),
                                           m_size( rhs.m_size ),
-                                          m_data_array( rhs.m_data_array ) {
+                                          m_capacity( rhs.m_capacity ),
+                                          m_data_array( rhs.m_data_array ),
+                                          m_aggregate_array( rhs.m_aggregate_array ),
+                                          m_buffers( rhs.m_buffers ),
+                                          m_lower_corner( rhs.m_lower_corner ),
+                                          m_upper_corner( rhs.m_upper_corner ),
+                                          m_lazy( std::move( rhs.m_lazy ) ) {
       rhs.m_data_array = nullptr;
+      rhs.m_aggregate_array = nullptr;
+      rhs.m_buffers = nullptr;
     }
 
     //Copy assignment
@@ -130,21 +510,12 @@ namespace geometricks {
     /**
     * @brief Copy assigns a kd tree.
     * @param rhs Right hand side of the copy operation.
-    * @details Performs a deep copy of the right hand side parameter. Destroys the previous kd tree and allocates memory to construct rhs into this.
-    * @note Complexity: @b O(n)
-    * @todo Change this method so we only allocate if the buffer isn't large enough.
-    * @todo Maybe we can get the strong exception guarantee here...
+    * @details Releases the previous points and shares the points of rhs, or copies them if rhs adopted its array, like the copy constructor.
+    * @note Complexity: @b O(1), plus the destruction of the previous points if no other tree shares them. @b O(n) if rhs adopted its array.
     */
     kd_tree& operator=( const kd_tree& rhs ) {
       if( &rhs != this ) {
-        //TODO: optimize to only allocate new buffer in case old capacity wasn't enough.
-        //TODO: exception guarantee.
-        Compare::operator=( rhs );
-        T* new_buff = ( T* ) m_allocator.allocate( sizeof( T ) * rhs.m_size );
-        std::copy( rhs.m_data_array, rhs.m_data_array + rhs.m_size, new_buff );
-        __destroy__();
-        m_data_array = new_buff;
-        m_size = rhs.m_size;
+        *this = kd_tree( rhs, m_allocator );
       }
       return *this;
     }
@@ -161,17 +532,26 @@ namespace geometricks {
     kd_tree& operator=( kd_tree&& rhs ) {
       if( &rhs != this ) {
         Compare::operator=( std::move( rhs ) );
-        __destroy__();
+        __release__();
         m_data_array = rhs.m_data_array;
+        m_aggregate_array = rhs.m_aggregate_array;
+        m_buffers = rhs.m_buffers;
+        m_lower_corner = rhs.m_lower_corner;
+        m_upper_corner = rhs.m_upper_corner;
         m_size = rhs.m_size;
+        m_capacity = rhs.m_capacity;
+        m_lazy = std::move( rhs.m_lazy );
+        ++m_generation;
         m_allocator = rhs.m_allocator;
         rhs.m_data_array = nullptr;
+        rhs.m_aggregate_array = nullptr;
+        rhs.m_buffers = nullptr;
       }
       return *this;
     }
 
     ~kd_tree() {
-      __destroy__();
+      __release__();
     }
 
     /**
@@ -211,13 +591,112 @@ namespace geometricks {
     template< typename DistanceFunction = dimension::euclidean_distance >
     auto
     nearest_neighbor( const T& point, DistanceFunction f = DistanceFunction{} ) const noexcept {
+      __detail__::__no_statistics__ stats;
+      return nearest_neighbor( point, f, stats );
+    }
+
+    /**
+    * @brief Finds the nearest neighbor of an input point, recording how much work the search did.
+    * @param point The input point to query.
+    * @param f Point distance function object. See the overload without statistics.
+    * @param stats Statistics object that receives the counters of the query. See geometricks::kd_tree_statistics and geometricks::kd_tree_shared_statistics.
+    * @details Same as the overload without statistics. Counters are added to the ones already present in stats.
+    */
+    template< typename DistanceFunction,
+              typename Statistics,
+              typename = std::enable_if_t<__detail__::is_kd_tree_statistics<Statistics>> >
+    auto
+    nearest_neighbor( const T& point, DistanceFunction f, Statistics& stats ) const noexcept {
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      distance_t best = meta::numeric_limits<distance_t>::max();
+      T* closest = nullptr;
+      __detail__::__accept_all__ filter;
+      __nearest_neighbor_impl__<0>( point, __root__(), &closest, best, f, filter, stats, 1 );
+      stats.on_result( 1 );
+      return std::pair<const T&, distance_t>( *closest, best );
+    }
+
+    /**
+    * @brief Finds the nearest neighbor of an input point, starting from a point that is likely close to it.
+    * @param point The input point to query.
+    * @param hint Index of a stored point close to the query, such as the result of the previous query of an object that moved slightly since.
+    * @param f Point distance function object. See the overload without a hint.
+    * @details The search bound is seeded with the distance to the hinted point before descending, so subtrees further than it are pruned from the first level
+    * instead of only after the first leaf was reached. The result is the same as without a hint, a bad hint only costs an extra distance evaluation.
+    * Example:
+    * @code{.cpp}
+      geometricks::nearest_neighbor_hint hint{ -1 };
+      for( auto& position : trajectory ) {
+        auto [nearest, distance] = tree.nearest_neighbor( position, hint );
+        hint.index = tree.index_of( nearest );
+      }
+    * @endcode
+    */
+    template< typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    nearest_neighbor( const T& point, nearest_neighbor_hint hint, DistanceFunction f = DistanceFunction{} ) const noexcept {
+      __detail__::__no_statistics__ stats;
+      return nearest_neighbor( point, hint, f, stats );
+    }
+
+    /**
+    * @brief Finds the nearest neighbor of an input point starting from a hint, recording how much work the search did.
+    * @param point The input point to query.
+    * @param hint Index of a stored point close to the query. See the overload without statistics.
+    * @param f Point distance function object. See geometricks::kd_tree::nearest_neighbor.
+    * @param stats Statistics object that receives the counters of the query. See geometricks::kd_tree_statistics and geometricks::kd_tree_shared_statistics.
+    */
+    template< typename DistanceFunction,
+              typename Statistics,
+              typename = std::enable_if_t<__detail__::is_kd_tree_statistics<Statistics>> >
+    auto
+    nearest_neighbor( const T& point, nearest_neighbor_hint hint, DistanceFunction f, Statistics& stats ) const noexcept {
       using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
       distance_t best = meta::numeric_limits<distance_t>::max();
       T* closest = nullptr;
-      __nearest_neighbor_impl__<0>( point, __root__(), &closest, best, f );
+      if( hint.index >= 0 && hint.index < m_size ) {
+        __touch_index__( hint.index );
+        closest = &m_data_array[ hint.index ];
+        best = f( point, *closest );
+        stats.on_distance_evaluation();
+      }
+      __detail__::__accept_all__ filter;
+      __nearest_neighbor_impl__<0>( point, __root__(), &closest, best, f, filter, stats, 1 );
+      stats.on_result( 1 );
       return std::pair<const T&, distance_t>( *closest, best );
     }
 
+    /**
+    * @brief Finds the nearest neighbor of an input point among the points accepted by a predicate.
+    * @param point The input point to query.
+    * @param pred Unary predicate called with the stored points. Only points for which it returns true are considered.
+    * @param f Point distance function object. See geometricks::kd_tree::nearest_neighbor.
+    * @return A pair containing a pointer to the nearest accepted point and its distance to the input point. If no point is accepted, the pointer is nullptr
+    * and the distance is the maximum value of the distance type.
+    * @details The predicate is evaluated during the traversal, before computing the distance to a point, so rejected points never tighten the search bound.
+    * This answers queries like "nearest point whose category is X" in a single pass, without guessing a K for geometricks::kd_tree::k_nearest_neighbor and
+    * filtering afterwards.
+    *
+    * Example:
+    * @code{.cpp}
+      auto [nearest, distance] = tree.nearest_neighbor_if( std::make_tuple( 10, 10, 10 ), []( const auto& point ) { return std::get<0>( point ) % 2 == 0; } );
+      if( nearest ) {
+        //nearest points to the closest point with an even first coordinate.
+      }
+    * @endcode
+    */
+    template< typename Predicate,
+              typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    nearest_neighbor_if( const T& point, Predicate pred, DistanceFunction f = DistanceFunction{} ) const {
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      distance_t best = meta::numeric_limits<distance_t>::max();
+      T* closest = nullptr;
+      __detail__::__no_statistics__ stats;
+      __nearest_neighbor_impl__<0>( point, __root__(), &closest, best, f, pred, stats, 1 );
+      return std::pair<const T*, distance_t>( closest, best );
+    }
+
     /**
     * @brief Finds the k nearest neighbors of an input point and returns a vector containing them and their distances.
     * @param point The input point to query.
@@ -259,118 +738,1171 @@ namespace geometricks {
     */
     template< typename DistanceFunction = dimension::euclidean_distance >
     auto
-    k_nearest_neighbor( const T& point, uint32_t K, DistanceFunction f = DistanceFunction{} ) ->
+    k_nearest_neighbor( const T& point, uint32_t K, DistanceFunction f = DistanceFunction{} ) const ->
     std::vector<std::pair<T, std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>>> {
-      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
-      std::vector<std::pair<T, distance_t>> output_col;
-      output_col.reserve( K );
-      std::priority_queue<std::pair<T*, distance_t>, small_vector<std::pair<T*, distance_t>, 11>, __heap_compare__> max_heap;
-      __k_nearest_neighbor_impl__<0, DistanceFunction, distance_t>( point, __root__(), K, max_heap, f );
-      while( !max_heap.empty() ) {
-        auto& element = max_heap.top();
-        meta::add_element( std::make_pair( *element.first, element.second ), output_col );
-        max_heap.pop();
-      }
-      std::reverse( output_col.begin(), output_col.end() );
-      return output_col;
+      __detail__::__no_statistics__ stats;
+      return k_nearest_neighbor( point, K, f, stats );
     }
 
     /**
-    * @brief Performs a range query on the collection.
-    * @param min_point Data containing the minimum values of the query.
-    * @param max_point Data containing the maximum values of the query.
-    * @return Vector containing all points in range.
-    * @details Computes and gathers all given points that lie within the region min_point and max_point and outputs them in a vector.
-    * Since the majority of the time is spent searching the tree for the output points, the algorithm first preprocess the input data so that there is no need for a precondition
-    * that the minimum point contains all the minimum values. Instead, the algorithm sorts both points before processing.
-    * Example:
-    * @code{.cpp}
-    std::vector<std::tuple<int, int, int>> input_vector;
-    ...
-    geometricks::kd_tree<std::tuple<int, int, int>> tree( input_vector.begin(), input_vector.end() );
-    auto output_vector = tree.range_search( std::make_tuple( 0, 50, 300 ), std::make_tuple( 57, 51, 500 ) ); //output_vector now contains all points between [0-57, 50-51, 300-500] from tree.
-    @endcode
-    * @todo Allow the user to input don't care values into the minimum and maximum point. Would need a new data structure for that.
+    * @brief Finds the k nearest neighbors of an input point, recording how much work the search did.
+    * @param point The input point to query.
+    * @param K the number of desired output points.
+    * @param f Point distance function object. See the overload without statistics.
+    * @param stats Statistics object that receives the counters of the query. See geometricks::kd_tree_statistics and geometricks::kd_tree_shared_statistics.
+    * @return A vector containing the output points as well as the distance calculated from the input point.
+    * @details Same as the overload without statistics. Counters are added to the ones already present in stats.
     */
-    std::vector<T>
-    range_search( T min_point, T max_point ) {
-      std::vector<T> output_col;
-      __organize_data__( min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>() );
-      __range_search_impl__<0>( min_point, max_point, __root__(), output_col );
-      return output_col;
+    template< typename DistanceFunction,
+              typename Statistics,
+              typename = std::enable_if_t<__detail__::is_kd_tree_statistics<Statistics>> >
+    auto
+    k_nearest_neighbor( const T& point, uint32_t K, DistanceFunction f, Statistics& stats ) const ->
+    std::vector<std::pair<T, std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>>> {
+      __detail__::__accept_all__ filter;
+      return __k_nearest_neighbor_search__( point, K, meta::numeric_limits<__distance_t__<DistanceFunction>>::max(), f, filter, stats, __copy_element__{} );
     }
 
-  private:
+    /**
+    * @brief Finds up to k nearest neighbors of an input point that lie within a maximum distance of it.
+    * @param point The input point to query.
+    * @param K the maximum number of desired output points.
+    * @param max_distance Points further than this distance from the input point, as computed by f, are ignored.
+    * @param f Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @return A vector containing the output points as well as the distance calculated from the input point, in ascending order.
+    * May contain less than K points if less than K points are within max_distance.
+    * @details The cutoff is used as the pruning bound from the start, so in sparse areas the search never walks towards far away points just to fill the K results.
+    * Note that the default distance is the squared euclidean distance, so max_distance should be squared as well.
+    */
+    template< typename DistanceType,
+              typename DistanceFunction = dimension::euclidean_distance,
+              typename = std::enable_if_t<std::is_arithmetic_v<DistanceType>> >
+    auto
+    k_nearest_neighbor( const T& point, uint32_t K, DistanceType max_distance, DistanceFunction f = DistanceFunction{} ) const ->
+    std::vector<std::pair<T, __distance_t__<DistanceFunction>>> {
+      __detail__::__no_statistics__ stats;
+      __detail__::__accept_all__ filter;
+      return __k_nearest_neighbor_search__( point, K, static_cast<__distance_t__<DistanceFunction>>( max_distance ), f, filter, stats, __copy_element__{} );
+    }
 
-    geometricks::allocator m_allocator;
+    /**
+    * @brief Finds the k nearest neighbors of an input point among the points accepted by a predicate.
+    * @param point The input point to query.
+    * @param K the number of desired output points.
+    * @param pred Unary predicate called with the stored points. Only points for which it returns true are considered.
+    * @param f Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @return A vector containing the output points as well as the distance calculated from the input point, in ascending order.
+    * May contain less than K points if less than K points are accepted by the predicate.
+    * @details The predicate is evaluated during the traversal, so only accepted points enter the heap and tighten the search bound. See also geometricks::kd_tree::nearest_neighbor_if.
+    */
+    template< typename Predicate,
+              typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    k_nearest_neighbor_if( const T& point, uint32_t K, Predicate pred, DistanceFunction f = DistanceFunction{} ) const ->
+    std::vector<std::pair<T, std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>>> {
+      __detail__::__no_statistics__ stats;
+      return __k_nearest_neighbor_search__( point, K, meta::numeric_limits<__distance_t__<DistanceFunction>>::max(), f, pred, stats, __copy_element__{} );
+    }
 
-    int32_t m_size;
+    /**
+    * @brief Finds the k nearest neighbors of an input point and returns pointers to them instead of copies.
+    * @param point The input point to query.
+    * @param K the number of desired output points.
+    * @param f Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @return A vector containing pointers to the output points stored in the tree as well as the distance calculated from the input point, in ascending order.
+    * @details Same as geometricks::kd_tree::k_nearest_neighbor, but the cost of building the output only depends on K and not on sizeof( T ), which matters
+    * for types carrying a large payload. The pointers are valid until the tree is destroyed or assigned to. Use geometricks::kd_tree::index_of to turn them into
+    * stable indices.
+    */
+    template< typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    k_nearest_neighbor_ptr( const T& point, uint32_t K, DistanceFunction f = DistanceFunction{} ) const ->
+    std::vector<std::pair<const T*, std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>>> {
+      __detail__::__no_statistics__ stats;
+      __detail__::__accept_all__ filter;
+      return __k_nearest_neighbor_search__( point, K, meta::numeric_limits<__distance_t__<DistanceFunction>>::max(), f, filter, stats, []( T* element ) -> const T* { return element; } );
+    }
 
-    T* m_data_array;
+    /**
+    * @brief Finds up to k nearest neighbors of an input point that lie within a maximum distance of it and returns pointers to them instead of copies.
+    * @param point The input point to query.
+    * @param K the maximum number of desired output points.
+    * @param max_distance Points further than this distance from the input point, as computed by f, are ignored.
+    * @param f Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @details Combines geometricks::kd_tree::k_nearest_neighbor_ptr with the cutoff of the bounded geometricks::kd_tree::k_nearest_neighbor overload.
+    */
+    template< typename DistanceType,
+              typename DistanceFunction = dimension::euclidean_distance,
+              typename = std::enable_if_t<std::is_arithmetic_v<DistanceType>> >
+    auto
+    k_nearest_neighbor_ptr( const T& point, uint32_t K, DistanceType max_distance, DistanceFunction f = DistanceFunction{} ) const ->
+    std::vector<std::pair<const T*, __distance_t__<DistanceFunction>>> {
+      __detail__::__no_statistics__ stats;
+      __detail__::__accept_all__ filter;
+      return __k_nearest_neighbor_search__( point, K, static_cast<__distance_t__<DistanceFunction>>( max_distance ), f, filter, stats, []( T* element ) -> const T* { return element; } );
+    }
 
-    static constexpr int DATA_DIMENSIONS = dimension::dimensional_traits<T>::dimensions;
+    /**
+    * @brief Sentinel marking the end of a geometricks::kd_tree::ranked_neighbor_iterator.
+    */
+    struct ranked_neighbor_sentinel {};
 
-    struct node_t {
+    /**
+    * @brief Input iterator over the points of a tree by increasing distance to a query point. See geometricks::kd_tree::ranked_nearest_neighbors.
+    * @tparam DistanceFunction Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @details Keeps a priority queue holding the subtrees that weren't explored yet, keyed by a lower bound of the distance to their points, along with the points
+    * whose distance is already known. Incrementing pops the closest entries, expanding subtrees, until a point is at the top, so each increment only explores the
+    * part of the tree needed to settle the next neighbor. The iterator is valid until the tree is destroyed, rebuilt or assigned to.
+    */
+    template< typename DistanceFunction >
+    struct ranked_neighbor_iterator {
 
-      int32_t m_index;
+      using distance_type = __distance_t__<DistanceFunction>;
 
-      int32_t m_block_size;
+      using value_type = std::pair<const T&, distance_type>;
 
-      operator bool() const {
-        return m_block_size;
-      }
+      using reference = value_type;
 
-    };
+      using pointer = void;
 
+      using difference_type = std::ptrdiff_t;
+
+      using iterator_category = std::input_iterator_tag;
+
+      ranked_neighbor_iterator( const kd_tree& tree, const T& point, DistanceFunction f ): m_tree( &tree ),
+                                                                                          m_point( point ),
+                                                                                          m_distance_function( f ) {
+        if( tree.m_size > 0 ) {
+          m_frontier.reserve( 64 );
+          node_t root = tree.__root__();
+          m_frontier.push_back( entry_t{ distance_type{}, root.m_index, root.m_block_size, 0 } );
+        }
+        __advance__();
+      }
+
+      /**
+      * @brief Returns the current point along with its distance to the query point.
+      * @pre The iterator doesn't compare equal to the sentinel.
+      */
+      value_type
+      operator*() const {
+        return { *m_current, m_current_distance };
+      }
+
+      /**
+      * @brief Moves to the next closest point.
+      * @pre The iterator doesn't compare equal to the sentinel.
+      */
+      ranked_neighbor_iterator&
+      operator++() {
+        __advance__();
+        return *this;
+      }
+
+      void
+      operator++( int ) {
+        __advance__();
+      }
+
+      friend bool
+      operator==( const ranked_neighbor_iterator& it, ranked_neighbor_sentinel ) noexcept {
+        return it.m_current == nullptr;
+      }
+
+      friend bool
+      operator==( ranked_neighbor_sentinel, const ranked_neighbor_iterator& it ) noexcept {
+        return it.m_current == nullptr;
+      }
+
+      friend bool
+      operator!=( const ranked_neighbor_iterator& it, ranked_neighbor_sentinel ) noexcept {
+        return it.m_current != nullptr;
+      }
+
+      friend bool
+      operator!=( ranked_neighbor_sentinel, const ranked_neighbor_iterator& it ) noexcept {
+        return it.m_current != nullptr;
+      }
+
+    private:
+
+      //A subtree keyed by a lower bound of the distance to its points, or a single point, with a block size of 0, keyed by its distance.
+      struct entry_t {
+
+        distance_type m_distance;
+
+        int32_t m_index;
+
+        int32_t m_block_size;
+
+        int m_dimension;
+
+      };
+
+      //Orders the heap so the smallest distance is at the top, with points before subtrees of the same distance.
+      struct __entry_compare__ {
+        bool operator()( const entry_t& lhs, const entry_t& rhs ) const noexcept {
+          if( rhs.m_distance < lhs.m_distance ) {
+            return true;
+          }
+          return !( lhs.m_distance < rhs.m_distance ) && lhs.m_block_size > rhs.m_block_size;
+        }
+      };
+
+      const kd_tree* m_tree;
+
+      T m_point;
+
+      DistanceFunction m_distance_function;
+
+      std::vector<entry_t> m_frontier;
+
+      const T* m_current = nullptr;
+
+      distance_type m_current_distance{};
+
+      void
+      __push__( const entry_t& entry ) {
+        m_frontier.push_back( entry );
+        std::push_heap( m_frontier.begin(), m_frontier.end(), __entry_compare__{} );
+      }
+
+      void
+      __advance__() {
+        m_current = nullptr;
+        while( !m_frontier.empty() ) {
+          std::pop_heap( m_frontier.begin(), m_frontier.end(), __entry_compare__{} );
+          entry_t entry = m_frontier.back();
+          m_frontier.pop_back();
+          if( entry.m_block_size == 0 ) {
+            m_current = &m_tree->m_data_array[ entry.m_index ];
+            m_current_distance = entry.m_distance;
+            return;
+          }
+          __detail__::dispatch_dimension<DATA_DIMENSIONS>( entry.m_dimension, [ this, &entry ]( auto dimension ) {
+            __expand__<decltype( dimension )::value>( entry );
+          } );
+        }
+      }
+
+      //Queues the point of a subtree and its children. Every point of the far child is at least as far as the splitting hyperplane, and the near child can't be
+      //closer than its parent, so both keys stay lower bounds.
+      template< int Dimension >
+      void
+      __expand__( const entry_t& entry ) {
+        constexpr int NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
+        node_t node{ entry.m_index, entry.m_block_size };
+        m_tree->__touch__( node );
+        const T& split_point = m_tree->m_data_array[ node.m_index ];
+        __push__( entry_t{ m_distance_function( m_point, split_point ), node.m_index, 0, 0 } );
+        node_t near_child = __left_child__( node );
+        node_t far_child = __right_child__( node );
+        if( !m_tree->__compare__( dimension::get( m_point, dimension::dimension_v<Dimension> ), dimension::get( split_point, dimension::dimension_v<Dimension> ) ) ) {
+          std::swap( near_child, far_child );
+        }
+        if( near_child ) {
+          __push__( entry_t{ entry.m_distance, near_child.m_index, near_child.m_block_size, NextDimension } );
+        }
+        if( far_child ) {
+          distance_type distance_to_hyperplane = __detail__::dimension_distance<Dimension>( m_distance_function, m_point, split_point );
+          __push__( entry_t{ std::max( entry.m_distance, distance_to_hyperplane ), far_child.m_index, far_child.m_block_size, NextDimension } );
+        }
+      }
+
+    };
+
+    /**
+    * @brief Range of the points of a tree by increasing distance to a query point, as returned by geometricks::kd_tree::ranked_nearest_neighbors.
+    */
+    template< typename DistanceFunction >
+    struct ranked_neighbor_range {
+
+      ranked_neighbor_iterator<DistanceFunction>
+      begin() const {
+        return ranked_neighbor_iterator<DistanceFunction>{ *m_tree, m_point, m_distance_function };
+      }
+
+      ranked_neighbor_sentinel
+      end() const noexcept {
+        return {};
+      }
+
+      const kd_tree* m_tree;
+
+      T m_point;
+
+      DistanceFunction m_distance_function;
+
+    };
+
+    /**
+    * @brief Visits the points of the tree by increasing distance to an input point, computing each neighbor only when it is asked for.
+    * @param point The input point to query.
+    * @param f Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @return A range whose iterators yield pairs of a reference to a point and its distance to the input point, in ascending distance order.
+    * @details Useful when the number of neighbors isn't known in advance, since calling geometricks::kd_tree::k_nearest_neighbor with a growing K repeats the
+    * whole search every time. The search keeps its frontier between increments, so stopping after K neighbors costs about as much as a k nearest neighbor query.
+    * Example:
+    * @code{.cpp}
+      for( auto [neighbor, distance] : tree.ranked_nearest_neighbors( std::make_tuple( 10, 10, 10 ) ) ) {
+        if( accept( neighbor ) ) {
+          break;
+        }
+      }
+    * @endcode
+    * @see Hjaltason and Samet, "Distance browsing in spatial databases", ACM Transactions on Database Systems, 1999.
+    */
+    template< typename DistanceFunction = dimension::euclidean_distance >
+    ranked_neighbor_range<DistanceFunction>
+    ranked_nearest_neighbors( const T& point, DistanceFunction f = DistanceFunction{} ) const {
+      return ranked_neighbor_range<DistanceFunction>{ this, point, f };
+    }
+
+    /**
+    * @brief Performs a range query on the collection using multiple threads.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @param thread_count Number of threads to use. Defaults to the number of hardware threads.
+    * @return Vector containing all points in range, in no particular order.
+    * @details The traversal is first done sequentially until a depth where there are several subtrees for each thread. Every subtree whose cell intersects the query
+    * box is then handed to a worker thread, which gathers its points into a thread local buffer. The buffers are concatenated at the end, so there is no contention
+    * on the output. Wide queries returning a large portion of the tree scale with the number of cores, while small queries are better served by geometricks::kd_tree::range_search.
+    * @see geometricks::kd_tree::range_search.
+    */
+    std::vector<T>
+    parallel_range_search( T min_point, T max_point, uint32_t thread_count = std::thread::hardware_concurrency() ) const {
+      std::vector<T> output_col;
+      if( m_size == 0 ) {
+        return output_col;
+      }
+      thread_count = std::max( thread_count, 1u );
+      __organize_data__( min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>() );
+      //Aim for about 8 subtrees per thread so a few expensive subtrees don't leave the other threads idle.
+      int32_t split_depth = 3;
+      while( ( 1u << split_depth ) < thread_count * 8 && split_depth < 24 ) {
+        ++split_depth;
+      }
+      std::vector<node_t> subtrees;
+      __collect_subtrees__<0>( min_point, max_point, __root__(), split_depth, subtrees, output_col );
+      std::vector<std::vector<T>> thread_output( std::min<size_t>( thread_count, subtrees.size() ) );
+      std::atomic<size_t> next_subtree{ 0 };
+      auto worker = [&]( std::vector<T>& local_output ) {
+        __detail__::__no_statistics__ stats;
+        for( size_t index = next_subtree++; index < subtrees.size(); index = next_subtree++ ) {
+          __detail__::dispatch_dimension<DATA_DIMENSIONS>( split_depth % DATA_DIMENSIONS, [&]( auto dimension ) {
+            __range_search_impl__<decltype( dimension )::value>( min_point, max_point, subtrees[ index ], local_output, stats, split_depth + 1 );
+          } );
+        }
+      };
+      std::vector<std::thread> threads;
+      threads.reserve( thread_output.size() );
+      for( size_t i = 1; i < thread_output.size(); ++i ) {
+        threads.emplace_back( worker, std::ref( thread_output[ i ] ) );
+      }
+      if( !thread_output.empty() ) {
+        worker( thread_output[ 0 ] );
+      }
+      for( auto& thread : threads ) {
+        thread.join();
+      }
+      size_t total_size = output_col.size();
+      for( auto& local_output : thread_output ) {
+        total_size += local_output.size();
+      }
+      output_col.reserve( total_size );
+      for( auto& local_output : thread_output ) {
+        std::move( local_output.begin(), local_output.end(), std::back_inserter( output_col ) );
+      }
+      return output_col;
+    }
+
+    /**
+    * @brief Finds the nearest neighbor of each point of a batch of queries.
+    * @param first Iterator to the first query point.
+    * @param last Iterator past the last query point.
+    * @param f Point distance function object. See geometricks::kd_tree::nearest_neighbor.
+    * @return A vector where the i-th element contains a pointer to the nearest neighbor of the i-th query and its distance.
+    * @pre Every dimension of T is arithmetic. [ first, last ) is a forward range.
+    * @details The queries are not executed in input order. They are sorted by the Morton code of their coordinates, quantized to the bounding box of the batch,
+    * so that consecutive queries land in nearby regions of the tree and reuse the nodes that are already in cache. The results are then scattered back into
+    * the input order. Large batches of random queries benefit the most.
+    */
+    template< typename ForwardIterator,
+              typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    batch_nearest_neighbor( ForwardIterator first, ForwardIterator last, DistanceFunction f = DistanceFunction{} ) const ->
+    std::vector<std::pair<const T*, std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>>> {
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      auto queries = __locality_order__( first, last );
+      std::vector<std::pair<const T*, distance_t>> output_col( queries.size() );
+      for( auto& [ query, index ] : queries ) {
+        auto [ nearest, distance ] = nearest_neighbor( *query, f );
+        output_col[ index ] = std::pair<const T*, distance_t>( &nearest, distance );
+      }
+      return output_col;
+    }
+
+    /**
+    * @brief Finds the k nearest neighbors of each point of a batch of queries.
+    * @param first Iterator to the first query point.
+    * @param last Iterator past the last query point.
+    * @param K the number of desired output points for each query.
+    * @param f Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @return A vector where the i-th element contains the output of geometricks::kd_tree::k_nearest_neighbor for the i-th query.
+    * @pre Every dimension of T is arithmetic. [ first, last ) is a forward range.
+    * @details The queries are executed in Morton order. See geometricks::kd_tree::batch_nearest_neighbor.
+    */
+    template< typename ForwardIterator,
+              typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    batch_k_nearest_neighbor( ForwardIterator first, ForwardIterator last, uint32_t K, DistanceFunction f = DistanceFunction{} ) const ->
+    std::vector<std::vector<std::pair<T, std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>>>> {
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      auto queries = __locality_order__( first, last );
+      std::vector<std::vector<std::pair<T, distance_t>>> output_col( queries.size() );
+      for( auto& [ query, index ] : queries ) {
+        output_col[ index ] = k_nearest_neighbor( *query, K, f );
+      }
+      return output_col;
+    }
+
+    /**
+    * @brief Returns the number of points stored in the tree.
+    */
+    int32_t
+    size() const noexcept {
+      return m_size;
+    }
+
+    /**
+    * @brief Returns the number of points the tree can hold without allocating, such as when calling geometricks::kd_tree::rebuild.
+    */
+    int32_t
+    capacity() const noexcept {
+      return m_capacity;
+    }
+
+    /**
+    * @brief Rebuilds the tree with a new range of elements, reusing the current storage.
+    * @param begin Iterator to first element of the input range.
+    * @param end Iterator to the last element of the input range or sentinel value.
+    * @pre If Sentinel is an iterator, first < last. Else, eventually first != last compares false.
+    * @post Invalidates every reference and pointer to the previous points.
+    * @details Destroys the stored points and constructs the points from [ begin, end ) in place, exactly as the constructor would. The buffers
+    * are only reallocated if capacity() is smaller than the size of the range or if they are shared with a copy of the tree, so rebuilding a tree of
+    * the same size, such as once per frame in a simulation, doesn't allocate. Copies of the tree keep the previous points. Like the constructor, the input range is partially reordered and is the only scratch memory used.
+    * Example:
+    * @code{.cpp}
+      geometricks::kd_tree<std::tuple<int, int, int>> tree{ particles.begin(), particles.end() };
+      while( running ) {
+        step( particles );
+        tree.rebuild( particles.begin(), particles.end() );
+        ...
+      }
+    * @endcode
+    * @note Complexity: @b O(n log n)
+    */
+    template< typename InputIterator, typename Sentinel >
+    void
+    rebuild( InputIterator begin, Sentinel end ) {
+      int32_t size = static_cast<int32_t>( std::distance( begin, end ) );
+      if( __is_shared__() ) {
+        __release__();
+      }
+      __clear__();
+      __reserve__( size );
+      __construct__( begin, end, size );
+      m_size = size;
+      ++m_generation;
+      __build_aggregates__();
+    }
+
+    /**
+    * @brief Returns a counter that changes every time the stored points are replaced, by geometricks::kd_tree::rebuild or by assignment.
+    * @details Lets objects holding results of this tree, such as geometricks::kd_tree_cache, detect that they are stale.
+    */
+    uint64_t
+    generation() const noexcept {
+      return m_generation;
+    }
+
+    /**
+    * @brief Accesses a stored point by its index in the underlying array.
+    * @param index Index of the point. Should be in the range [ 0, size() ).
+    * @see geometricks::kd_tree::index_of.
+    */
+    const T&
+    operator[]( int32_t index ) const noexcept {
+      return m_data_array[ index ];
+    }
+
+    /**
+    * @brief Returns the index in the underlying array of a point stored in the tree.
+    * @param element Reference to a point stored in this tree, such as the ones returned by the queries.
+    * @pre element must be a reference to a point stored in this tree.
+    */
+    int32_t
+    index_of( const T& element ) const noexcept {
+      return static_cast<int32_t>( &element - m_data_array );
+    }
+
+    /**
+    * @brief Performs a range query on the collection.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @return Vector containing all points in range.
+    * @details Computes and gathers all given points that lie within the region min_point and max_point and outputs them in a vector.
+    * Since the majority of the time is spent searching the tree for the output points, the algorithm first preprocess the input data so that there is no need for a precondition
+    * that the minimum point contains all the minimum values. Instead, the algorithm sorts both points before processing.
+    * Example:
+    * @code{.cpp}
+    std::vector<std::tuple<int, int, int>> input_vector;
+    ...
+    geometricks::kd_tree<std::tuple<int, int, int>> tree( input_vector.begin(), input_vector.end() );
+    auto output_vector = tree.range_search( std::make_tuple( 0, 50, 300 ), std::make_tuple( 57, 51, 500 ) ); //output_vector now contains all points between [0-57, 50-51, 300-500] from tree.
+    @endcode
+    * @todo Allow the user to input don't care values into the minimum and maximum point. Would need a new data structure for that.
+    */
+    std::vector<T>
+    range_search( T min_point, T max_point ) const {
+      __detail__::__no_statistics__ stats;
+      return range_search( min_point, max_point, stats );
+    }
+
+    /**
+    * @brief Performs a range query on the collection, recording how much work the search did.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @param stats Statistics object that receives the counters of the query. See geometricks::kd_tree_statistics and geometricks::kd_tree_shared_statistics.
+    * @return Vector containing all points in range.
+    * @details Same as the overload without statistics. Counters are added to the ones already present in stats.
+    */
+    template< typename Statistics,
+              typename = std::enable_if_t<__detail__::is_kd_tree_statistics<Statistics>> >
+    std::vector<T>
+    range_search( T min_point, T max_point, Statistics& stats ) const {
+      std::vector<T> output_col;
+      __organize_data__( min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>() );
+      __range_search_impl__<0>( min_point, max_point, __root__(), output_col, stats, 1 );
+      stats.on_result( output_col.size() );
+      return output_col;
+    }
+
+    /**
+    * @brief Sentinel marking the end of a geometricks::kd_tree::range_search_iterator.
+    */
+    struct range_search_sentinel {};
+
+    /**
+    * @brief Input iterator over the points of a tree that lie within a box. See geometricks::kd_tree::lazy_range_search.
+    * @details Walks the tree like geometricks::kd_tree::range_search, with an explicit stack holding the subtrees left to visit instead of the call stack, and stops
+    * every time it finds a point in range. The iterator is valid until the tree is destroyed, rebuilt or assigned to.
+    */
+    struct range_search_iterator {
+
+      using value_type = T;
+
+      using reference = const T&;
+
+      using pointer = const T*;
+
+      using difference_type = std::ptrdiff_t;
+
+      using iterator_category = std::input_iterator_tag;
+
+      range_search_iterator( const kd_tree& tree, const T& min_point, const T& max_point ): m_tree( &tree ),
+                                                                                            m_min_point( min_point ),
+                                                                                            m_max_point( max_point ) {
+        tree.__organize_data__( m_min_point, m_max_point, std::make_index_sequence<DATA_DIMENSIONS>() );
+        if( tree.m_size > 0 ) {
+          m_stack.reserve( 64 );
+          node_t root = tree.__root__();
+          m_stack.push_back( entry_t{ root.m_index, root.m_block_size, 0 } );
+        }
+        __advance__();
+      }
+
+      /**
+      * @brief Returns the current point.
+      * @pre The iterator doesn't compare equal to the sentinel.
+      */
+      const T&
+      operator*() const noexcept {
+        return *m_current;
+      }
+
+      const T*
+      operator->() const noexcept {
+        return m_current;
+      }
+
+      /**
+      * @brief Moves to the next point in range.
+      * @pre The iterator doesn't compare equal to the sentinel.
+      */
+      range_search_iterator&
+      operator++() {
+        __advance__();
+        return *this;
+      }
+
+      void
+      operator++( int ) {
+        __advance__();
+      }
+
+      friend bool
+      operator==( const range_search_iterator& it, range_search_sentinel ) noexcept {
+        return it.m_current == nullptr;
+      }
+
+      friend bool
+      operator==( range_search_sentinel, const range_search_iterator& it ) noexcept {
+        return it.m_current == nullptr;
+      }
+
+      friend bool
+      operator!=( const range_search_iterator& it, range_search_sentinel ) noexcept {
+        return it.m_current != nullptr;
+      }
+
+      friend bool
+      operator!=( range_search_sentinel, const range_search_iterator& it ) noexcept {
+        return it.m_current != nullptr;
+      }
+
+    private:
+
+      struct entry_t {
+
+        int32_t m_index;
+
+        int32_t m_block_size;
+
+        int m_dimension;
+
+      };
+
+      const kd_tree* m_tree;
+
+      T m_min_point;
+
+      T m_max_point;
+
+      std::vector<entry_t> m_stack;
+
+      const T* m_current = nullptr;
+
+      void
+      __advance__() {
+        m_current = nullptr;
+        while( !m_stack.empty() && m_current == nullptr ) {
+          entry_t entry = m_stack.back();
+          m_stack.pop_back();
+          __detail__::dispatch_dimension<DATA_DIMENSIONS>( entry.m_dimension, [ this, &entry ]( auto dimension ) {
+            __visit__<decltype( dimension )::value>( entry );
+          } );
+        }
+      }
+
+      //Same decisions as __range_search_impl__. The left child is pushed last so the points come out in the same order as geometricks::kd_tree::range_search.
+      template< int CurrentDimension >
+      void
+      __visit__( const entry_t& entry ) {
+        constexpr int NextDimension = ( CurrentDimension + 1 ) % DATA_DIMENSIONS;
+        node_t node{ entry.m_index, entry.m_block_size };
+        m_tree->__touch__( node );
+        const T& current_point = m_tree->m_data_array[ node.m_index ];
+        bool visit_left = !m_tree->__compare__( dimension::get( current_point, dimension::dimension_v<CurrentDimension> ), dimension::get( m_min_point, dimension::dimension_v<CurrentDimension> ) );
+        bool visit_right = !m_tree->__compare__( dimension::get( m_max_point, dimension::dimension_v<CurrentDimension> ), dimension::get( current_point, dimension::dimension_v<CurrentDimension> ) );
+        node_t right_child = __right_child__( node );
+        if( visit_right && right_child ) {
+          m_stack.push_back( entry_t{ right_child.m_index, right_child.m_block_size, NextDimension } );
+        }
+        node_t left_child = __left_child__( node );
+        if( visit_left && left_child ) {
+          m_stack.push_back( entry_t{ left_child.m_index, left_child.m_block_size, NextDimension } );
+        }
+        if( visit_left && visit_right && m_tree->template __is_inside_bounding_box__<CurrentDimension>( current_point, m_min_point, m_max_point ) ) {
+          m_current = &current_point;
+        }
+      }
+
+    };
+
+    /**
+    * @brief Range of the points of a tree that lie within a box, as returned by geometricks::kd_tree::lazy_range_search.
+    */
+    struct range_search_view {
+
+      range_search_iterator
+      begin() const {
+        return range_search_iterator{ *m_tree, m_min_point, m_max_point };
+      }
+
+      range_search_sentinel
+      end() const noexcept {
+        return {};
+      }
+
+      const kd_tree* m_tree;
+
+      T m_min_point;
+
+      T m_max_point;
+
+    };
+
+    /**
+    * @brief Performs a range query on the collection that finds the points in range one at a time, as they are asked for.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @return A range over references to the points in range, in the same order as geometricks::kd_tree::range_search.
+    * @details Nothing is searched until the range is iterated, and every increment only walks the tree up to the next point in range, so consumers can start
+    * working on the first points right away and stop early without paying for the rest of the region. Nothing is copied or allocated per point. As with
+    * geometricks::kd_tree::range_search, min_point and max_point don't need to be sorted.
+    * Example:
+    * @code{.cpp}
+      for( const auto& point : tree.lazy_range_search( std::make_tuple( 0, 50, 300 ), std::make_tuple( 57, 51, 500 ) ) ) {
+        if( process( point ) ) {
+          break;
+        }
+      }
+    * @endcode
+    */
+    range_search_view
+    lazy_range_search( const T& min_point, const T& max_point ) const {
+      return range_search_view{ this, min_point, max_point };
+    }
+
+    /**
+    * @brief Performs a range query that only constrains some of the dimensions.
+    * @tparam Dimensions The constrained dimensions, known at compile time.
+    * @param min_point Data containing the minimum values of the query. Values of dimensions that aren't constrained are ignored.
+    * @param max_point Data containing the maximum values of the query. Values of dimensions that aren't constrained are ignored.
+    * @return Vector containing all points whose constrained dimensions are in range.
+    * @details Unlike faking the unconstrained dimensions with the limits of their types in geometricks::kd_tree::range_search, levels splitting on an unconstrained dimension
+    * don't compare anything: both children are visited directly.
+    * Example:
+    * @code{.cpp}
+    geometricks::kd_tree<std::tuple<int, int, int>> tree( input_vector.begin(), input_vector.end() );
+    auto output_vector = tree.partial_range_search<0, 2>( std::make_tuple( 0, 0, 300 ), std::make_tuple( 57, 0, 500 ) ); //output_vector now contains all points between [0-57, *, 300-500].
+    @endcode
+    */
+    template< int... Dimensions >
+    std::vector<T>
+    partial_range_search( T min_point, T max_point ) const {
+      static_assert( sizeof...( Dimensions ) > 0 && ( ( Dimensions >= 0 && Dimensions < DATA_DIMENSIONS ) && ... ), "Constrained dimensions should be valid dimensions of T." );
+      return __partial_range_search__( min_point, max_point, __detail__::__static_dimension_mask__<Dimensions...>{} );
+    }
+
+    /**
+    * @brief Performs a range query that only constrains the dimensions selected at runtime.
+    * @param min_point Data containing the minimum values of the query. Values of dimensions that aren't constrained are ignored.
+    * @param max_point Data containing the maximum values of the query. Values of dimensions that aren't constrained are ignored.
+    * @param constrained Bit I is set if dimension I is constrained.
+    * @return Vector containing all points whose constrained dimensions are in range.
+    * @details Same as the compile time overload, but the dimensions are only known at runtime.
+    */
+    std::vector<T>
+    partial_range_search( T min_point, T max_point, std::bitset<dimension::dimensional_traits<T>::dimensions> constrained ) const {
+      return __partial_range_search__( min_point, max_point, __detail__::__runtime_dimension_mask__<DATA_DIMENSIONS>{ constrained } );
+    }
+
+    /**
+    * @brief Combines the aggregate monoid values of every point inside a range, without collecting the points.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @return The combination of the values of every point inside the range, or the identity of the monoid if there is none.
+    * @pre Traits::aggregate_monoid is not void. See geometricks::kd_tree_traits::aggregate_monoid.
+    * @details Follows the same traversal as geometricks::kd_tree::range_search, but keeps track of the cell of each subtree, which is bounded by the splitting points of its
+    * ancestors and by the bounding box of the points, computed at build time. When a cell lies entirely inside the query box, the value precomputed for that subtree at build time is used and the subtree isn't visited, so the cost
+    * depends on how many cells the border of the box crosses rather than on the number of points inside it.
+    * Example:
+    * @code{.cpp}
+    geometricks::kd_tree<std::tuple<int, int, int>, std::less<>, counting_traits> tree( input_vector.begin(), input_vector.end() );
+    int64_t count = tree.range_aggregate( std::make_tuple( 0, 50, 300 ), std::make_tuple( 57, 51, 500 ) ); //count now contains the number of points between [0-57, 50-51, 300-500].
+    @endcode
+    */
+    auto
+    range_aggregate( T min_point, T max_point ) const {
+      __detail__::__no_statistics__ stats;
+      return range_aggregate( min_point, max_point, stats );
+    }
+
+    /**
+    * @brief Combines the aggregate monoid values of every point inside a range, recording how much work the query did.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @param stats Statistics object that receives the counters of the query. See geometricks::kd_tree_statistics and geometricks::kd_tree_shared_statistics.
+    * @return The combination of the values of every point inside the range, or the identity of the monoid if there is none.
+    * @details Same as the overload without statistics. Subtrees answered from their precomputed value count as a single visited node.
+    */
+    template< typename Statistics,
+              typename = std::enable_if_t<__detail__::is_kd_tree_statistics<Statistics>> >
+    auto
+    range_aggregate( T min_point, T max_point, Statistics& stats ) const {
+      static_assert( HAS_AGGREGATES, "range_aggregate needs an aggregate monoid. See geometricks::kd_tree_traits::aggregate_monoid." );
+      aggregate_monoid_t monoid{};
+      aggregate_t output = monoid.identity();
+      if( m_size == 0 ) {
+        return output;
+      }
+      __organize_data__( min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>() );
+      std::array<const T*, DATA_DIMENSIONS> lower_bounds;
+      std::array<const T*, DATA_DIMENSIONS> upper_bounds;
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        lower_bounds[ i ] = &m_data_array[ m_lower_corner[ i ] ];
+        upper_bounds[ i ] = &m_data_array[ m_upper_corner[ i ] ];
+      }
+      __range_aggregate_impl__<0>( min_point, max_point, __root__(), lower_bounds, upper_bounds, output, stats, 1 );
+      return output;
+    }
+
+  private:
+
+    //Output converts the T* stored in the heap into whatever the public function returns. Copying T out of the heap is done by the
+    //k_nearest_neighbor overloads, while k_nearest_neighbor_ptr only hands out pointers.
+    //Points further than max_distance are never reported, and the cutoff is the pruning bound until K points were found.
+    template< typename DistanceFunction, typename Filter, typename Statistics, typename Output >
+    auto
+    __k_nearest_neighbor_search__( const T& point, uint32_t K, __distance_t__<DistanceFunction> max_distance, DistanceFunction& f, Filter& filter, Statistics& stats, Output output ) const {
+      using distance_t = __distance_t__<DistanceFunction>;
+      using output_t = std::decay_t<decltype( output( std::declval<T*>() ) )>;
+      std::vector<std::pair<output_t, distance_t>> output_col;
+      output_col.reserve( K );
+      std::priority_queue<std::pair<T*, distance_t>, small_vector<std::pair<T*, distance_t>, 11>, __heap_compare__> max_heap;
+      __k_nearest_neighbor_impl__<0, DistanceFunction, distance_t>( point, __root__(), K, max_distance, max_heap, f, filter, stats, 1 );
+      stats.on_result( max_heap.size() );
+      while( !max_heap.empty() ) {
+        auto& element = max_heap.top();
+        meta::add_element( std::make_pair( output( element.first ), element.second ), output_col );
+        max_heap.pop();
+      }
+      std::reverse( output_col.begin(), output_col.end() );
+      return output_col;
+    }
+
+    struct __copy_element__ {
+      const T& operator()( T* element ) const noexcept {
+        return *element;
+      }
+    };
+
+    geometricks::allocator m_allocator;
+
+    int32_t m_size;
+
+    //Number of points m_data_array and m_aggregate_array have room for.
+    int32_t m_capacity;
+
+    //Incremented every time the stored points are replaced.
+    uint64_t m_generation = 0;
+
+    T* m_data_array;
+
+    using aggregate_monoid_t = typename Traits::aggregate_monoid;
+
+    using aggregate_t = typename __detail__::__aggregate_value__<aggregate_monoid_t>::type;
+
+    static constexpr bool HAS_AGGREGATES = !std::is_void_v<aggregate_monoid_t>;
+
+    //Value of the aggregate monoid for the subtree rooted at each node, stored at the same index as the node. Null when Traits doesn't enable aggregates.
+    aggregate_t* m_aggregate_array;
+
+    //Ownership of m_data_array and m_aggregate_array, shared by a tree and its copies. Allocated with the allocator it stores, like the buffers.
+    struct __shared_buffers__ {
+
+      explicit __shared_buffers__( geometricks::allocator alloc, bool adopted = false ): m_allocator( alloc ), m_adopted( adopted ) {
+      }
+
+      std::atomic<int32_t> m_references{ 1 };
+
+      //Allocator the buffers were allocated with, which is the allocator of the tree that was copied rather than the one of the copies.
+      geometricks::allocator m_allocator;
+
+      //Whether the data array was adopted. Adopted arrays are never shared.
+      bool m_adopted;
+
+    };
+
+    //Null only for trees that were moved from.
+    __shared_buffers__* m_buffers;
+
+    static constexpr int DATA_DIMENSIONS = dimension::dimensional_traits<T>::dimensions;
+
+    static constexpr int PREFETCH_DEPTH = Traits::prefetch_depth;
+
+    static_assert( PREFETCH_DEPTH >= 0 && PREFETCH_DEPTH <= 4, "Prefetching more than 4 levels ahead issues too many prefetches per visited node." );
+
+    static constexpr bool IS_LAZY = Traits::lazy_subtree_size > 0;
+
+    static_assert( !( IS_LAZY && HAS_AGGREGATES ), "Aggregates are computed at build time, so they can't be combined with lazy construction." );
+
+    //Indices of the points holding the smallest and largest value of each dimension, which bound the cell of the root in geometricks::kd_tree::range_aggregate.
+    //Only computed when Traits enables aggregates.
+    std::array<int32_t, DATA_DIMENSIONS> m_lower_corner{};
+
+    std::array<int32_t, DATA_DIMENSIONS> m_upper_corner{};
+
+    //Returns the queries paired with their input position, sorted by the Morton code of their coordinates.
+    template< typename ForwardIterator >
+    static std::vector<std::pair<const T*, size_t>>
+    __locality_order__( ForwardIterator first, ForwardIterator last ) {
+      std::vector<std::pair<const T*, size_t>> queries;
+      std::array<double, DATA_DIMENSIONS> min_values;
+      std::array<double, DATA_DIMENSIONS> max_values;
+      min_values.fill( std::numeric_limits<double>::max() );
+      max_values.fill( std::numeric_limits<double>::lowest() );
+      for( size_t index = 0; first != last; ++first, ++index ) {
+        const T& query = *first;
+        __expand_bounds__( query, min_values, max_values, std::make_index_sequence<DATA_DIMENSIONS>{} );
+        queries.emplace_back( &query, index );
+      }
+      std::vector<std::pair<uint64_t, size_t>> keys;
+      keys.reserve( queries.size() );
+      for( size_t index = 0; index < queries.size(); ++index ) {
+        std::array<uint32_t, DATA_DIMENSIONS> cell;
+        __quantize__( *queries[ index ].first, min_values, max_values, cell, std::make_index_sequence<DATA_DIMENSIONS>{} );
+        keys.emplace_back( algorithm::morton_encode( cell ), index );
+      }
+      std::sort( keys.begin(), keys.end() );
+      std::vector<std::pair<const T*, size_t>> output_col;
+      output_col.reserve( queries.size() );
+      for( auto& key : keys ) {
+        output_col.push_back( queries[ key.second ] );
+      }
+      return output_col;
+    }
+
+    template< size_t... Is >
+    static void
+    __expand_bounds__( const T& point, std::array<double, DATA_DIMENSIONS>& min_values, std::array<double, DATA_DIMENSIONS>& max_values, std::index_sequence<Is...> ) {
+      static_assert( ( std::is_arithmetic_v<dimension::type_at<T, Is>> && ... ), "Batch queries need arithmetic coordinates to compute the Morton order." );
+      ( ( min_values[ Is ] = std::min( min_values[ Is ], static_cast<double>( dimension::get( point, dimension::dimension_v<Is> ) ) ),
+          max_values[ Is ] = std::max( max_values[ Is ], static_cast<double>( dimension::get( point, dimension::dimension_v<Is> ) ) ) ), ... );
+    }
+
+    template< size_t... Is >
+    static void
+    __quantize__( const T& point, const std::array<double, DATA_DIMENSIONS>& min_values, const std::array<double, DATA_DIMENSIONS>& max_values,
+                  std::array<uint32_t, DATA_DIMENSIONS>& cell, std::index_sequence<Is...> ) {
+      constexpr double MAX_CELL = static_cast<double>( ( uint64_t( 1 ) << algorithm::morton_bits_per_dimension<DATA_DIMENSIONS> ) - 1 );
+      auto quantize = [=]( double value, double min_value, double max_value ) {
+        return max_value > min_value ? static_cast<uint32_t>( ( value - min_value ) / ( max_value - min_value ) * MAX_CELL ) : 0u;
+      };
+      ( ( cell[ Is ] = quantize( static_cast<double>( dimension::get( point, dimension::dimension_v<Is> ) ), min_values[ Is ], max_values[ Is ] ) ), ... );
+    }
+
+    struct node_t {
+
+      int32_t m_index;
+
+      int32_t m_block_size;
+
+      operator bool() const {
+        return m_block_size;
+      }
+
+    };
+
+    //Subtrees whose construction was deferred by a lazy build. All of them are at the same depth, so they split on the same dimension, and since the sizes of
+    //the subtrees of a level differ by at most 1 while every other level is at least twice as large or half as small, a node is one of them if and only if its
+    //block size falls in [ m_min_block_size, m_max_block_size ].
+    struct __lazy_subtrees__ {
+
+      //Root of each subtree, in increasing index order.
+      std::vector<node_t> m_roots;
+
+      std::unique_ptr<std::once_flag[]> m_built;
+
+      int32_t m_min_block_size = std::numeric_limits<int32_t>::max();
+
+      int32_t m_max_block_size = 0;
+
+      int m_dimension = 0;
+
+    };
+
+    //Null unless some subtrees are still waiting to be built.
+    std::unique_ptr<__lazy_subtrees__> m_lazy;
+
+    __shared_buffers__*
+    __allocate_buffers__( bool adopted = false ) {
+      void* memory = m_allocator.allocate( sizeof( __shared_buffers__ ), alignof( __shared_buffers__ ) );
+      return new ( memory ) __shared_buffers__( m_allocator, adopted );
+    }
+
+    //Adds a reference to the buffers for a new copy of the tree. The copy may read any point, so deferred subtrees are built first.
+    __shared_buffers__*
+    __share__() const {
+      __finish_construction__();
+      if( m_buffers != nullptr ) {
+        m_buffers->m_references.fetch_add( 1, std::memory_order_relaxed );
+      }
+      return m_buffers;
+    }
+
+    bool
+    __is_shared__() const noexcept {
+      return m_buffers != nullptr && m_buffers->m_references.load( std::memory_order_acquire ) > 1;
+    }
+
+    //Drops the reference of this tree to its buffers, destroying the points and deallocating the buffers if it was the last one, and leaves the tree empty
+    //without buffers.
+    void
+    __release__() {
+      if( m_buffers != nullptr ) {
+        if( m_buffers->m_references.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+          __clear__();
+          if( m_data_array != nullptr ) {
+            m_buffers->m_allocator.deallocate( m_data_array );
+          }
+          if( m_aggregate_array != nullptr ) {
+            m_buffers->m_allocator.deallocate( m_aggregate_array );
+          }
+          geometricks::allocator buffers_allocator = m_buffers->m_allocator;
+          m_buffers->~__shared_buffers__();
+          buffers_allocator.deallocate( m_buffers );
+        }
+        m_buffers = nullptr;
+      }
+      m_data_array = nullptr;
+      m_aggregate_array = nullptr;
+      m_size = 0;
+      m_capacity = 0;
+      m_lazy.reset();
+    }
+
+    //Destroys the stored points and aggregates, keeping the buffers. Should only be called when no other tree shares them.
     void
-    __destroy__() {
+    __clear__() {
       if( m_data_array != nullptr ) {
         for( int32_t i = 0; i < m_size; ++i ) {
           m_data_array[ i ].~T();
         }
-        m_allocator.deallocate( m_data_array );
       }
+      if( m_aggregate_array != nullptr ) {
+        for( int32_t i = 0; i < m_size; ++i ) {
+          m_aggregate_array[ i ].~aggregate_t();
+        }
+      }
+      m_size = 0;
+      m_lazy.reset();
+    }
+
+    //Makes sure the buffers have room for size points. Should only be called when the tree is empty and doesn't share its buffers.
+    void
+    __reserve__( int32_t size ) {
+      if( m_buffers == nullptr || m_capacity < size ) {
+        __release__();
+        m_data_array = ( T* ) m_allocator.allocate( sizeof( T ) * size );
+        m_aggregate_array = __allocate_aggregates__( size );
+        m_buffers = __allocate_buffers__();
+        m_capacity = size;
+      }
+    }
+
+    void
+    __copy_aggregates__( const kd_tree& rhs ) {
+      if constexpr( HAS_AGGREGATES ) {
+        std::uninitialized_copy( rhs.m_aggregate_array, rhs.m_aggregate_array + rhs.m_size, m_aggregate_array );
+      }
+      else {
+        ( void ) rhs;
+      }
+    }
+
+    aggregate_t*
+    __allocate_aggregates__( int32_t size ) {
+      if constexpr( HAS_AGGREGATES ) {
+        return ( aggregate_t* ) m_allocator.allocate( sizeof( aggregate_t ) * size, alignof( aggregate_t ) );
+      }
+      else {
+        ( void ) size;
+        return nullptr;
+      }
+    }
+
+    void
+    __build_aggregates__() {
+      if constexpr( HAS_AGGREGATES ) {
+        if( m_size > 0 ) {
+          aggregate_monoid_t monoid{};
+          __build_aggregates__( monoid, __root__() );
+          __compute_corners__( std::make_index_sequence<DATA_DIMENSIONS>{} );
+        }
+      }
+    }
+
+    template< size_t... Is >
+    void
+    __compute_corners__( std::index_sequence<Is...> ) {
+      m_lower_corner.fill( 0 );
+      m_upper_corner.fill( 0 );
+      for( int32_t index = 1; index < m_size; ++index ) {
+        ( __expand_corners__<Is>( index ), ... );
+      }
+    }
+
+    template< int Dimension >
+    void
+    __expand_corners__( int32_t index ) {
+      const T& point = m_data_array[ index ];
+      if( Compare::operator()( dimension::get( point, dimension::dimension_v<Dimension> ), dimension::get( m_data_array[ m_lower_corner[ Dimension ] ], dimension::dimension_v<Dimension> ) ) ) {
+        m_lower_corner[ Dimension ] = index;
+      }
+      if( Compare::operator()( dimension::get( m_data_array[ m_upper_corner[ Dimension ] ], dimension::dimension_v<Dimension> ), dimension::get( point, dimension::dimension_v<Dimension> ) ) ) {
+        m_upper_corner[ Dimension ] = index;
+      }
+    }
+
+    //The subtree of a node occupies a contiguous block of the array, so its aggregate only depends on the aggregates of its children and on the node itself.
+    template< typename Monoid >
+    aggregate_t
+    __build_aggregates__( Monoid& monoid, node_t node ) {
+      aggregate_t value = monoid.lift( m_data_array[ node.m_index ] );
+      node_t left_child = __left_child__( node );
+      if( left_child ) {
+        value = monoid.combine( __build_aggregates__( monoid, left_child ), value );
+      }
+      node_t right_child = __right_child__( node );
+      if( right_child ) {
+        value = monoid.combine( value, __build_aggregates__( monoid, right_child ) );
+      }
+      new ( &m_aggregate_array[ node.m_index ] ) aggregate_t( value );
+      return value;
     }
 
-    template< int Dimension, typename DistanceFunction, typename DistanceType >
+    template< int Dimension, typename DistanceFunction, typename DistanceType, typename Filter, typename Statistics >
     void
-    __nearest_neighbor_impl__( const T& point, const node_t& cur_node, T** closest, DistanceType& best_distance, DistanceFunction f ) const {
+    __nearest_neighbor_impl__( const T& point, const node_t& cur_node, T** closest, DistanceType& best_distance, DistanceFunction& f, Filter& filter, Statistics& stats, int32_t depth ) const {
       constexpr size_t NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
       auto compare_function = [this]( const T& left, const T& right ) {
         return Compare::operator()( dimension::get( left, dimension::dimension_v<Dimension> ), dimension::get( right, dimension::dimension_v<Dimension> ) );
       };
-      auto distance_function = [ &f ]( auto&& lhs, auto&& rhs ) {
-        constexpr int I = Dimension;
-        if constexpr( __detail__::has_dimension_compare<DistanceFunction, T, T, I> ) {
-          return f( std::forward<decltype( lhs )>( lhs ), std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> );
-        }
-        else if constexpr( __detail__::has_dimension_compare<DistanceFunction, T, dimension::type_at<T, I>, I> ) {
-          return f( std::forward<decltype( lhs )>( lhs ), dimension::get( std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> ), dimension::dimension_v<I> );
-        }
-        else if constexpr( __detail__::has_dimension_compare<DistanceFunction, dimension::type_at<T, I>, T, I> ) {
-          return f( dimension::get( std::forward<decltype( lhs )>( lhs ), dimension::dimension_v<I> ), std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> );
-        }
-        else if constexpr( __detail__::has_dimension_compare<DistanceFunction, dimension::type_at<T, I>, dimension::type_at<T, I>, I> ) {
-          return f( dimension::get( std::forward<decltype( lhs )>( lhs ), dimension::dimension_v<I> ), dimension::get( std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> ), dimension::dimension_v<I> );
-        }
-        else {
-          static_assert( __detail__::has_value_compare<DistanceFunction, dimension::type_at<T, I>, dimension::type_at<T, I>>, "Please supply a dimension compare, a value, value, dimension compare or a value compare." );
-          return f( dimension::get( std::forward<decltype( lhs )>( lhs ), dimension::dimension_v<I> ), dimension::get( std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> ) );
-        }
+      auto distance_function = [ &f ]( const T& lhs, const T& rhs ) {
+        return __detail__::dimension_distance<Dimension>( f, lhs, rhs );
       };
+      __touch__( cur_node );
+      stats.on_visit( depth );
+      __prefetch_descendants__( cur_node );
       if( compare_function( point, m_data_array[ cur_node.m_index ] ) ) {
         //The point is to the left of the current axis.
         //Recurse left...
         auto left_child = __left_child__( cur_node );
         if( left_child ) {
-          __nearest_neighbor_impl__<NextDimension>( point, left_child, closest, best_distance, f );
+          __nearest_neighbor_impl__<NextDimension>( point, left_child, closest, best_distance, f, filter, stats, depth + 1 );
         }
-        //Now we get the distance from the point to the current node.
-        auto distance = f( point, m_data_array[ cur_node.m_index ] );
-        //If the distance is better than our current best distance, update it.
-        if( distance < best_distance ) {
-          best_distance = distance;
-          *closest = &m_data_array[ cur_node.m_index ];
+        //Now we get the distance from the point to the current node, as long as the filter accepts it.
+        if( filter( m_data_array[ cur_node.m_index ] ) ) {
+          auto distance = f( point, m_data_array[ cur_node.m_index ] );
+          stats.on_distance_evaluation();
+          //If the distance is better than our current best distance, update it.
+          if( distance < best_distance ) {
+            best_distance = distance;
+            *closest = &m_data_array[ cur_node.m_index ];
+          }
         }
         //If we have another branch to search...
         auto right_child = __right_child__( cur_node );
@@ -378,7 +1910,10 @@ namespace geometricks {
           //Finally, check the distance to the hyperplane.
           auto distance_to_hyperplane = distance_function( point, m_data_array[ cur_node.m_index ] );
           if( distance_to_hyperplane < best_distance ) {
-            __nearest_neighbor_impl__<NextDimension>( point, right_child, closest, best_distance, f );
+            __nearest_neighbor_impl__<NextDimension>( point, right_child, closest, best_distance, f, filter, stats, depth + 1 );
+          }
+          else {
+            stats.on_prune();
           }
         }
 
@@ -388,14 +1923,17 @@ namespace geometricks {
         //Recurse right..
         auto right_child = __right_child__( cur_node );
         if( right_child ) {
-          __nearest_neighbor_impl__<NextDimension>( point, right_child, closest, best_distance, f );
+          __nearest_neighbor_impl__<NextDimension>( point, right_child, closest, best_distance, f, filter, stats, depth + 1 );
         }
-        //Now we get the distance from the point to the current node.
-        auto distance = f( point, m_data_array[ cur_node.m_index ] );
-        //If the distance is better than our current best distance, update it.
-        if( distance < best_distance ) {
-          best_distance = distance;
-          *closest = &m_data_array[ cur_node.m_index ];
+        //Now we get the distance from the point to the current node, as long as the filter accepts it.
+        if( filter( m_data_array[ cur_node.m_index ] ) ) {
+          auto distance = f( point, m_data_array[ cur_node.m_index ] );
+          stats.on_distance_evaluation();
+          //If the distance is better than our current best distance, update it.
+          if( distance < best_distance ) {
+            best_distance = distance;
+            *closest = &m_data_array[ cur_node.m_index ];
+          }
         }
         //If we have another branch to search...
         auto left_child = __left_child__( cur_node );
@@ -403,7 +1941,10 @@ namespace geometricks {
           //Finally, check the distance to the hyperplane.
           auto distance_to_hyperplane = distance_function( point, m_data_array[ cur_node.m_index ] );
           if( distance_to_hyperplane < best_distance ) {
-            __nearest_neighbor_impl__<NextDimension>( point, left_child, closest, best_distance, f );
+            __nearest_neighbor_impl__<NextDimension>( point, left_child, closest, best_distance, f, filter, stats, depth + 1 );
+          }
+          else {
+            stats.on_prune();
           }
         }
       }
@@ -411,74 +1952,222 @@ namespace geometricks {
 
     template< int Dimension,
               typename DistanceFunction,
-              typename DistanceType >
+              typename DistanceType,
+              typename Filter,
+              typename Statistics >
     void __k_nearest_neighbor_impl__( const T& point,
                                       const node_t& node,
                                       uint32_t K,
+                                      const DistanceType& max_distance,
                                       std::priority_queue<std::pair<T*, DistanceType>, small_vector<std::pair<T*, DistanceType>, 11>, __heap_compare__>& max_heap,
-                                      DistanceFunction f ) {
+                                      DistanceFunction& f,
+                                      Filter& filter,
+                                      Statistics& stats,
+                                      int32_t depth ) const {
       constexpr size_t NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
       auto compare_function = [this]( const T& left, const T& right ) {
         return Compare::operator()( dimension::get( left, dimension::dimension_v<Dimension> ), dimension::get( right, dimension::dimension_v<Dimension> ) );
       };
 
-      auto distance_function = [ &f ]( auto&& lhs, auto&& rhs ) {
-        constexpr int I = Dimension;
-        if constexpr( __detail__::has_dimension_compare<DistanceFunction, T, T, I> ) {
-          return f( std::forward<decltype( lhs )>( lhs ), std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> );
-        }
-        else if constexpr( __detail__::has_dimension_compare<DistanceFunction, T, dimension::type_at<T, I>, I> ) {
-          return f( std::forward<decltype( lhs )>( lhs ), dimension::get( std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> ), dimension::dimension_v<I> );
-        }
-        else if constexpr( __detail__::has_dimension_compare<DistanceFunction, dimension::type_at<T, I>, T, I> ) {
-          return f( dimension::get( std::forward<decltype( lhs )>( lhs ), dimension::dimension_v<I> ), std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> );
-        }
-        else if constexpr( __detail__::has_dimension_compare<DistanceFunction, dimension::type_at<T, I>, dimension::type_at<T, I>, I> ) {
-          return f( dimension::get( std::forward<decltype( lhs )>( lhs ), dimension::dimension_v<I> ), dimension::get( std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> ), dimension::dimension_v<I> );
-        }
-        else {
-          static_assert( __detail__::has_value_compare<DistanceFunction, dimension::type_at<T, I>, dimension::type_at<T, I>>, "Please supply a dimension compare, a value, value, dimension compare or a value compare." );
-          return f( dimension::get( std::forward<decltype( lhs )>( lhs ), dimension::dimension_v<I> ), dimension::get( std::forward<decltype( rhs )>( rhs ), dimension::dimension_v<I> ) );
-        }
+      auto distance_function = [ &f ]( const T& lhs, const T& rhs ) {
+        return __detail__::dimension_distance<Dimension>( f, lhs, rhs );
       };
+      __touch__( node );
+      stats.on_visit( depth );
+      __prefetch_descendants__( node );
       if( compare_function( point, m_data_array[ node.m_index ] ) ) {
         auto left_child = __left_child__( node );
         if( left_child ) {
-          __k_nearest_neighbor_impl__<NextDimension, DistanceFunction, DistanceType>( point, left_child, K, max_heap, f );
+          __k_nearest_neighbor_impl__<NextDimension, DistanceFunction, DistanceType>( point, left_child, K, max_distance, max_heap, f, filter, stats, depth + 1 );
         }
-        auto distance = f( point, m_data_array[ node.m_index ] );
-        auto heap_element = std::make_pair( &m_data_array[ node.m_index ], distance );
-        max_heap.push( heap_element );
-        if( ( uint32_t )max_heap.size() > K ) {
-          max_heap.pop();
+        if( filter( m_data_array[ node.m_index ] ) ) {
+          auto distance = f( point, m_data_array[ node.m_index ] );
+          stats.on_distance_evaluation();
+          if( !( max_distance < distance ) ) {
+            auto heap_element = std::make_pair( &m_data_array[ node.m_index ], distance );
+            max_heap.push( heap_element );
+            if( ( uint32_t )max_heap.size() > K ) {
+              max_heap.pop();
+            }
+          }
         }
         auto right_child = __right_child__( node );
         if( right_child ) {
           auto distance_to_hyperplane = distance_function( point, m_data_array[ node.m_index ] );
-          if( ( uint32_t )max_heap.size() < K || distance_to_hyperplane < max_heap.top().second ) {
-            __k_nearest_neighbor_impl__<NextDimension, DistanceFunction, DistanceType>( point, right_child, K, max_heap, f );
+          if( ( uint32_t )max_heap.size() < K ? !( max_distance < distance_to_hyperplane ) : distance_to_hyperplane < max_heap.top().second ) {
+            __k_nearest_neighbor_impl__<NextDimension, DistanceFunction, DistanceType>( point, right_child, K, max_distance, max_heap, f, filter, stats, depth + 1 );
+          }
+          else {
+            stats.on_prune();
           }
         }
       }
       else {
         auto right_child = __right_child__( node );
         if( right_child ) {
-          __k_nearest_neighbor_impl__<NextDimension, DistanceFunction, DistanceType>( point, right_child, K, max_heap, f );
+          __k_nearest_neighbor_impl__<NextDimension, DistanceFunction, DistanceType>( point, right_child, K, max_distance, max_heap, f, filter, stats, depth + 1 );
         }
-        auto distance = f( point, m_data_array[ node.m_index ] );
-        auto heap_element = std::make_pair( &m_data_array[ node.m_index ], distance );
-        max_heap.push( heap_element );
-        if( ( uint32_t )max_heap.size() > K ) {
-          max_heap.pop();
+        if( filter( m_data_array[ node.m_index ] ) ) {
+          auto distance = f( point, m_data_array[ node.m_index ] );
+          stats.on_distance_evaluation();
+          if( !( max_distance < distance ) ) {
+            auto heap_element = std::make_pair( &m_data_array[ node.m_index ], distance );
+            max_heap.push( heap_element );
+            if( ( uint32_t )max_heap.size() > K ) {
+              max_heap.pop();
+            }
+          }
         }
         auto left_child = __left_child__( node );
         if( left_child ) {
           auto distance_to_hyperplane = distance_function( point, m_data_array[ node.m_index ] );
-          if( ( uint32_t )max_heap.size() < K || distance_to_hyperplane < max_heap.top().second ) {
-            __k_nearest_neighbor_impl__<NextDimension, DistanceFunction, DistanceType>( point, left_child, K, max_heap, f );
+          if( ( uint32_t )max_heap.size() < K ? !( max_distance < distance_to_hyperplane ) : distance_to_hyperplane < max_heap.top().second ) {
+            __k_nearest_neighbor_impl__<NextDimension, DistanceFunction, DistanceType>( point, left_child, K, max_distance, max_heap, f, filter, stats, depth + 1 );
+          }
+          else {
+            stats.on_prune();
+          }
+        }
+      }
+    }
+
+    template< typename InputIterator, typename Sentinel >
+    void
+    __construct__( InputIterator begin, Sentinel end, int32_t size ) {
+      if constexpr( IS_LAZY ) {
+        for( T* output = m_data_array; begin != end; ++begin, ++output ) {
+          new ( output ) T{ *begin };
+        }
+        __defer_subtrees__( size );
+      }
+      else {
+        __construct_kd_tree__<0>( begin, end, 0, size );
+      }
+    }
+
+    //Partitions the levels above the first one whose subtrees hold at most Traits::lazy_subtree_size points and records the subtrees of that level.
+    void
+    __defer_subtrees__( int32_t size ) {
+      if( size == 0 ) {
+        return;
+      }
+      int32_t lazy_depth = 0;
+      for( int32_t block_size = size; block_size > Traits::lazy_subtree_size; block_size >>= 1 ) {
+        ++lazy_depth;
+      }
+      auto lazy = std::make_unique<__lazy_subtrees__>();
+      lazy->m_dimension = lazy_depth % DATA_DIMENSIONS;
+      node_t root{ size >> 1, size };
+      __partition_levels__<0>( root, lazy_depth, *lazy );
+      //Below 2 points, the block sizes of the deferred level could overlap the ones of the level under it, so there is nothing worth deferring.
+      if( lazy->m_min_block_size < 2 ) {
+        __detail__::dispatch_dimension<DATA_DIMENSIONS>( lazy->m_dimension, [&]( auto dimension ) {
+          for( node_t subtree : lazy->m_roots ) {
+            __build_subtree__<decltype( dimension )::value>( subtree );
+          }
+        } );
+        return;
+      }
+      lazy->m_built = std::make_unique<std::once_flag[]>( lazy->m_roots.size() );
+      m_lazy = std::move( lazy );
+    }
+
+    template< int Dimension >
+    void
+    __partition_levels__( node_t node, int32_t levels, __lazy_subtrees__& lazy ) {
+      if( !node ) {
+        return;
+      }
+      if( levels == 0 ) {
+        lazy.m_roots.push_back( node );
+        lazy.m_min_block_size = std::min( lazy.m_min_block_size, node.m_block_size );
+        lazy.m_max_block_size = std::max( lazy.m_max_block_size, node.m_block_size );
+        return;
+      }
+      constexpr int NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
+      __select_median__<Dimension>( node );
+      __partition_levels__<NextDimension>( __left_child__( node ), levels - 1, lazy );
+      __partition_levels__<NextDimension>( __right_child__( node ), levels - 1, lazy );
+    }
+
+    template< int Dimension >
+    void
+    __select_median__( node_t node ) const {
+      T* first = m_data_array + ( node.m_index - ( node.m_block_size >> 1 ) );
+      auto less_function = [this]( const T& left, const T& right ) {
+        return Compare::operator()( dimension::get( left, dimension::dimension_v<Dimension> ), dimension::get( right, dimension::dimension_v<Dimension> ) );
+      };
+      typename Traits::split_selection{}( first, m_data_array + node.m_index, first + node.m_block_size, less_function );
+    }
+
+    //Builds the subtree of node in place. The points of the subtree already occupy its block, in any order.
+    template< int Dimension >
+    void
+    __build_subtree__( node_t node ) const {
+      if( node ) {
+        constexpr int NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
+        __select_median__<Dimension>( node );
+        __build_subtree__<NextDimension>( __left_child__( node ) );
+        __build_subtree__<NextDimension>( __right_child__( node ) );
+      }
+    }
+
+    //Called by the traversals before reading a node. Builds the subtree rooted at node if its construction was deferred and nobody built it yet.
+    void
+    __touch__( node_t node ) const {
+      if constexpr( IS_LAZY ) {
+        if( m_lazy && node.m_block_size >= m_lazy->m_min_block_size && node.m_block_size <= m_lazy->m_max_block_size ) {
+          auto position = std::lower_bound( m_lazy->m_roots.begin(), m_lazy->m_roots.end(), node, []( const node_t& lhs, const node_t& rhs ) {
+            return lhs.m_index < rhs.m_index;
+          } ) - m_lazy->m_roots.begin();
+          std::call_once( m_lazy->m_built[ position ], [ this, node ]() {
+            __detail__::dispatch_dimension<DATA_DIMENSIONS>( m_lazy->m_dimension, [ this, node ]( auto dimension ) {
+              __build_subtree__<decltype( dimension )::value>( node );
+            } );
+          } );
+        }
+      }
+      else {
+        ( void ) node;
+      }
+    }
+
+    //Builds the deferred subtree whose block holds index, if any, so the point at index is in its final place. Deferred blocks are disjoint and their roots are
+    //sorted by index, so the block is the one of the last root starting at or before index.
+    void
+    __touch_index__( int32_t index ) const {
+      if constexpr( IS_LAZY ) {
+        if( m_lazy ) {
+          auto position = std::upper_bound( m_lazy->m_roots.begin(), m_lazy->m_roots.end(), index, []( int32_t value, const node_t& root ) {
+            return value < root.m_index - ( root.m_block_size >> 1 );
+          } );
+          if( position != m_lazy->m_roots.begin() ) {
+            node_t root = *std::prev( position );
+            if( index < root.m_index - ( root.m_block_size >> 1 ) + root.m_block_size ) {
+              __touch__( root );
+            }
           }
         }
       }
+      else {
+        ( void ) index;
+      }
+    }
+
+    //Builds every deferred subtree, so the array has its final layout.
+    void
+    __finish_construction__() const {
+      if constexpr( IS_LAZY ) {
+        if( m_lazy ) {
+          __detail__::dispatch_dimension<DATA_DIMENSIONS>( m_lazy->m_dimension, [ this ]( auto dimension ) {
+            for( size_t i = 0; i < m_lazy->m_roots.size(); ++i ) {
+              std::call_once( m_lazy->m_built[ i ], [ this, i ]() {
+                __build_subtree__<decltype( dimension )::value>( m_lazy->m_roots[ i ] );
+              } );
+            }
+          } );
+        }
+      }
     }
 
     template< int Dimension, typename InputIterator, typename Sentinel >
@@ -493,7 +2182,7 @@ namespace geometricks {
         auto less_function = [this]( const T& left, const T& right ) {
           return Compare::operator()( dimension::get( left, dimension::dimension_v<Dimension> ), dimension::get( right, dimension::dimension_v<Dimension> ) );
         };
-        std::nth_element( begin, middle ,end, less_function );
+        typename Traits::split_selection{}( begin, middle, end, less_function );
         new ( &m_data_array[ insert_index ] ) T{ *middle };
         __construct_kd_tree__<NextDimension>( begin, middle, startind_index, step );
         std::advance( middle, 1 );
@@ -507,6 +2196,35 @@ namespace geometricks {
       return Compare::operator()( first, second );
     }
 
+    //Issues prefetches for the descendants of a node PREFETCH_DEPTH levels below it. No-op if prefetching is disabled.
+    void
+    __prefetch_descendants__( node_t node ) const noexcept {
+      if constexpr( PREFETCH_DEPTH > 0 ) {
+        __prefetch_level__<PREFETCH_DEPTH>( node );
+      }
+      else {
+        ( void ) node;
+      }
+    }
+
+    template< int Levels >
+    void
+    __prefetch_level__( node_t node ) const noexcept {
+      if constexpr( Levels == 0 ) {
+        __detail__::__prefetch__( &m_data_array[ node.m_index ] );
+      }
+      else {
+        node_t left_child = __left_child__( node );
+        if( left_child ) {
+          __prefetch_level__<Levels - 1>( left_child );
+        }
+        node_t right_child = __right_child__( node );
+        if( right_child ) {
+          __prefetch_level__<Levels - 1>( right_child );
+        }
+      }
+    }
+
     node_t
     __root__() const {
       return { m_size >> 1, m_size };
@@ -538,36 +2256,45 @@ namespace geometricks {
 
     template< size_t... Is >
     void
-    __organize_data__( T& first, T& second, std::index_sequence<Is...> ) {
+    __organize_data__( T& first, T& second, std::index_sequence<Is...> ) const {
       ( __swap_if_greater__( dimension::get( first, dimension::dimension_v<Is> ), dimension::get( second, dimension::dimension_v<Is> ) ), ... );
     }
 
     template< typename DataType >
     void
-    __swap_if_greater__( DataType& first, DataType& second ) {
+    __swap_if_greater__( DataType& first, DataType& second ) const {
       if( !Compare::operator()( first, second ) ) {
         using std::swap;
         swap( first, second );
       }
     }
 
-    template< int CurrentDimension, typename Collection >
+    template< int CurrentDimension, typename Collection, typename Statistics >
     void
-    __range_search_impl__( const T& min_point, const T& max_point, node_t current_node, Collection& output_collection ) {
+    __range_search_impl__( const T& min_point, const T& max_point, node_t current_node, Collection& output_collection, Statistics& stats, int32_t depth ) const {
+      __touch__( current_node );
+      stats.on_visit( depth );
+      __prefetch_descendants__( current_node );
       T& current_point = m_data_array[ current_node.m_index ];
       constexpr int NextDimension = ( CurrentDimension + 1 ) % DATA_DIMENSIONS;
       if( Compare::operator()( dimension::get( current_point, dimension::dimension_v<CurrentDimension> ), dimension::get( min_point, dimension::dimension_v<CurrentDimension> ) ) ) {
         //If we're to the "left" side of the minimum value, we can discard the left children of this node since all of them would be on the left as well.
+        if( __left_child__( current_node ) ) {
+          stats.on_prune();
+        }
         node_t next_node = __right_child__( current_node );
         if( next_node ) {
-          __range_search_impl__<NextDimension>( min_point, max_point, next_node, output_collection );
+          __range_search_impl__<NextDimension>( min_point, max_point, next_node, output_collection, stats, depth + 1 );
         }
       }
       else if( Compare::operator()( dimension::get( max_point, dimension::dimension_v<CurrentDimension> ), dimension::get( current_point, dimension::dimension_v<CurrentDimension> ) ) ) {
         //If we're to the "right" side of the maximum value, we can discard the right children of this node since all of them would be on the right as well.
+        if( __right_child__( current_node ) ) {
+          stats.on_prune();
+        }
         node_t next_node = __left_child__( current_node );
         if( next_node ) {
-          __range_search_impl__<NextDimension>( min_point, max_point, next_node, output_collection );
+          __range_search_impl__<NextDimension>( min_point, max_point, next_node, output_collection, stats, depth + 1 );
         }
       }
       else {
@@ -578,30 +2305,150 @@ namespace geometricks {
         }
         node_t left_child = __left_child__( current_node );
         if( left_child ) {
-          __range_search_impl__<NextDimension>( min_point, max_point, left_child, output_collection );
+          __range_search_impl__<NextDimension>( min_point, max_point, left_child, output_collection, stats, depth + 1 );
         }
         node_t right_child = __right_child__( current_node );
         if( right_child ) {
-          __range_search_impl__<NextDimension>( min_point, max_point, right_child, output_collection );
+          __range_search_impl__<NextDimension>( min_point, max_point, right_child, output_collection, stats, depth + 1 );
         }
       }
     }
 
+    template< typename Mask >
+    std::vector<T>
+    __partial_range_search__( T& min_point, T& max_point, const Mask& mask ) const {
+      std::vector<T> output_col;
+      if( m_size > 0 ) {
+        __organize_data__( min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>() );
+        __partial_range_search_impl__<0>( min_point, max_point, __root__(), output_col, mask );
+      }
+      return output_col;
+    }
+
+    template< int CurrentDimension, typename Collection, typename Mask >
+    void
+    __partial_range_search_impl__( const T& min_point, const T& max_point, node_t current_node, Collection& output_collection, const Mask& mask ) const {
+      __touch__( current_node );
+      __prefetch_descendants__( current_node );
+      const T& current_point = m_data_array[ current_node.m_index ];
+      constexpr int NextDimension = ( CurrentDimension + 1 ) % DATA_DIMENSIONS;
+      bool visit_left = true;
+      bool visit_right = true;
+      if( mask.template is_constrained<CurrentDimension>() ) {
+        visit_left = !Compare::operator()( dimension::get( current_point, dimension::dimension_v<CurrentDimension> ), dimension::get( min_point, dimension::dimension_v<CurrentDimension> ) );
+        visit_right = !Compare::operator()( dimension::get( max_point, dimension::dimension_v<CurrentDimension> ), dimension::get( current_point, dimension::dimension_v<CurrentDimension> ) );
+      }
+      if( visit_left && visit_right && __is_inside_partial_box__<CurrentDimension>( current_point, min_point, max_point, mask, std::make_index_sequence<DATA_DIMENSIONS>{} ) ) {
+        meta::add_element( current_point, output_collection );
+      }
+      node_t left_child = __left_child__( current_node );
+      if( visit_left && left_child ) {
+        __partial_range_search_impl__<NextDimension>( min_point, max_point, left_child, output_collection, mask );
+      }
+      node_t right_child = __right_child__( current_node );
+      if( visit_right && right_child ) {
+        __partial_range_search_impl__<NextDimension>( min_point, max_point, right_child, output_collection, mask );
+      }
+    }
+
+    template< int CurrentDimension, typename Mask, size_t... Is >
+    bool
+    __is_inside_partial_box__( const T& point, const T& min_point, const T& max_point, const Mask& mask, std::index_sequence<Is...> ) const {
+      return ( ( !mask.template is_constrained<Is>() ||
+                 __is_inside_interval__<CurrentDimension, Is>( dimension::get( point, dimension::dimension_v<Is> ), dimension::get( min_point, dimension::dimension_v<Is> ), dimension::get( max_point, dimension::dimension_v<Is> ) ) ) && ... );
+    }
+
+    //Same traversal as __range_search_impl__. lower_bounds and upper_bounds hold, for each dimension, the ancestor whose split bounds the cell of current_node, or the
+    //point at that side of the bounding box while no ancestor does.
+    template< int CurrentDimension, typename Statistics >
+    void
+    __range_aggregate_impl__( const T& min_point, const T& max_point, node_t current_node, std::array<const T*, DATA_DIMENSIONS>& lower_bounds,
+                              std::array<const T*, DATA_DIMENSIONS>& upper_bounds, aggregate_t& output, Statistics& stats, int32_t depth ) const {
+      aggregate_monoid_t monoid{};
+      stats.on_visit( depth );
+      if( __is_cell_inside__( min_point, max_point, lower_bounds, upper_bounds, std::make_index_sequence<DATA_DIMENSIONS>{} ) ) {
+        output = monoid.combine( output, m_aggregate_array[ current_node.m_index ] );
+        return;
+      }
+      const T& current_point = m_data_array[ current_node.m_index ];
+      constexpr int NextDimension = ( CurrentDimension + 1 ) % DATA_DIMENSIONS;
+      bool visit_left = !Compare::operator()( dimension::get( current_point, dimension::dimension_v<CurrentDimension> ), dimension::get( min_point, dimension::dimension_v<CurrentDimension> ) );
+      bool visit_right = !Compare::operator()( dimension::get( max_point, dimension::dimension_v<CurrentDimension> ), dimension::get( current_point, dimension::dimension_v<CurrentDimension> ) );
+      if( visit_left && visit_right && __is_inside_bounding_box__<CurrentDimension>( current_point, min_point, max_point ) ) {
+        output = monoid.combine( output, monoid.lift( current_point ) );
+      }
+      node_t left_child = __left_child__( current_node );
+      if( visit_left && left_child ) {
+        const T* previous_bound = upper_bounds[ CurrentDimension ];
+        upper_bounds[ CurrentDimension ] = &current_point;
+        __range_aggregate_impl__<NextDimension>( min_point, max_point, left_child, lower_bounds, upper_bounds, output, stats, depth + 1 );
+        upper_bounds[ CurrentDimension ] = previous_bound;
+      }
+      else if( left_child ) {
+        stats.on_prune();
+      }
+      node_t right_child = __right_child__( current_node );
+      if( visit_right && right_child ) {
+        const T* previous_bound = lower_bounds[ CurrentDimension ];
+        lower_bounds[ CurrentDimension ] = &current_point;
+        __range_aggregate_impl__<NextDimension>( min_point, max_point, right_child, lower_bounds, upper_bounds, output, stats, depth + 1 );
+        lower_bounds[ CurrentDimension ] = previous_bound;
+      }
+      else if( right_child ) {
+        stats.on_prune();
+      }
+    }
+
+    template< size_t... Is >
+    bool
+    __is_cell_inside__( const T& min_point, const T& max_point, const std::array<const T*, DATA_DIMENSIONS>& lower_bounds,
+                        const std::array<const T*, DATA_DIMENSIONS>& upper_bounds, std::index_sequence<Is...> ) const {
+      return ( ( !Compare::operator()( dimension::get( *lower_bounds[ Is ], dimension::dimension_v<Is> ), dimension::get( min_point, dimension::dimension_v<Is> ) ) &&
+                 !Compare::operator()( dimension::get( max_point, dimension::dimension_v<Is> ), dimension::get( *upper_bounds[ Is ], dimension::dimension_v<Is> ) ) ) && ... );
+    }
+
+    //Same traversal as __range_search_impl__, but stops at split_depth and stores the nodes found there instead of visiting them.
+    //Every node stored in subtrees is at depth split_depth, so all of them split on dimension split_depth % DATA_DIMENSIONS.
+    template< int CurrentDimension >
+    void
+    __collect_subtrees__( const T& min_point, const T& max_point, node_t current_node, int32_t split_depth, std::vector<node_t>& subtrees, std::vector<T>& output_collection ) const {
+      if( split_depth == 0 ) {
+        subtrees.push_back( current_node );
+        return;
+      }
+      __touch__( current_node );
+      const T& current_point = m_data_array[ current_node.m_index ];
+      constexpr int NextDimension = ( CurrentDimension + 1 ) % DATA_DIMENSIONS;
+      bool visit_left = !Compare::operator()( dimension::get( current_point, dimension::dimension_v<CurrentDimension> ), dimension::get( min_point, dimension::dimension_v<CurrentDimension> ) );
+      bool visit_right = !Compare::operator()( dimension::get( max_point, dimension::dimension_v<CurrentDimension> ), dimension::get( current_point, dimension::dimension_v<CurrentDimension> ) );
+      if( visit_left && visit_right && __is_inside_bounding_box__<CurrentDimension>( current_point, min_point, max_point ) ) {
+        meta::add_element( current_point, output_collection );
+      }
+      node_t left_child = __left_child__( current_node );
+      if( visit_left && left_child ) {
+        __collect_subtrees__<NextDimension>( min_point, max_point, left_child, split_depth - 1, subtrees, output_collection );
+      }
+      node_t right_child = __right_child__( current_node );
+      if( visit_right && right_child ) {
+        __collect_subtrees__<NextDimension>( min_point, max_point, right_child, split_depth - 1, subtrees, output_collection );
+      }
+    }
+
     template< int CurrentDimension >
     constexpr bool
-    __is_inside_bounding_box__( const T& point, const T& min_point, const T& max_point ) {
+    __is_inside_bounding_box__( const T& point, const T& min_point, const T& max_point ) const {
       return __is_inside_bounding_box_helper__<CurrentDimension>( point, min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>{} );
     }
 
     template< int CurrentDimension, size_t... Is >
     constexpr bool
-    __is_inside_bounding_box_helper__( const T& point, const T& min_point, const T& max_point, std::index_sequence<Is...> ) {
+    __is_inside_bounding_box_helper__( const T& point, const T& min_point, const T& max_point, std::index_sequence<Is...> ) const {
       return ( __is_inside_interval__<CurrentDimension, Is>( dimension::get( point, dimension::dimension_v<Is> ), dimension::get( min_point, dimension::dimension_v<Is> ), dimension::get( max_point, dimension::dimension_v<Is> ) ) && ... );
     }
 
     template< int CurrentDimension, int Index, typename DataType >
     constexpr bool
-    __is_inside_interval__( const DataType& point, const DataType& min, const DataType& max ) {
+    __is_inside_interval__( const DataType& point, const DataType& min, const DataType& max ) const {
       if constexpr( CurrentDimension == Index ) {
         return true;
       }
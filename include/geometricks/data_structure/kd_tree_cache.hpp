@@ -0,0 +1,299 @@
+#ifndef GEOMETRICKS_DATA_STRUCTURE_KD_TREE_CACHE_HPP
+#define GEOMETRICKS_DATA_STRUCTURE_KD_TREE_CACHE_HPP
+
+//C stdlib includes
+#include <stdint.h>
+
+//C++ stdlib includes
+#include <array>
+#include <cmath>
+#include <functional>
+#include <list>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+//Project includes
+#include "dimensional_traits.hpp"
+
+/**
+* @file Implements a least recently used cache of nearest neighbor query results.
+*/
+
+namespace geometricks {
+
+  /**
+  * @brief Cache key function that uses the query point itself, so only exactly repeated queries hit the cache.
+  */
+  struct exact_point_key {
+
+    template< typename T >
+    constexpr const T&
+    operator()( const T& point ) const noexcept {
+      return point;
+    }
+
+  };
+
+  /**
+  * @brief Cache key function that maps the query point to the cell of a grid, so nearby queries share a cached result.
+  * @tparam N The number of dimensions.
+  * @tparam CellSize The type of the cell sizes.
+  * @details The key of a point is floor( point[ i ] / cell_size[ i ] ) in each dimension. A hit returns the nearest neighbor of the first query that filled the
+  * cell, which is only an approximation for the other points of the cell, so the cell size bounds the error the caller is willing to accept.
+  */
+  template< size_t N, typename CellSize = double >
+  struct quantized_point_key {
+
+    /**
+    * @brief Constructs the key function with the size of the cells in each dimension.
+    * @param cell_size The size of the cells. Should be positive.
+    */
+    constexpr quantized_point_key( const std::array<CellSize, N>& cell_size ) noexcept: m_cell_size( cell_size ) {
+    }
+
+    template< typename T >
+    std::array<int64_t, N>
+    operator()( const T& point ) const {
+      static_assert( dimension::dimensional_traits<T>::dimensions == N, "The number of cell sizes should match the number of dimensions." );
+      return __quantize__( point, std::make_index_sequence<N>{} );
+    }
+
+  private:
+
+    std::array<CellSize, N> m_cell_size;
+
+    template< typename T, size_t... Is >
+    std::array<int64_t, N>
+    __quantize__( const T& point, std::index_sequence<Is...> ) const {
+      return { static_cast<int64_t>( std::floor( static_cast<double>( dimension::get( point, dimension::dimension_v<Is> ) ) / static_cast<double>( m_cell_size[ Is ] ) ) )... };
+    }
+
+  };
+
+  template< typename CellSize, size_t N >
+  quantized_point_key( const std::array<CellSize, N>& ) -> quantized_point_key<N, CellSize>;
+
+  /**
+  * @cond EXCLUDE_DOXYGEN
+  *
+  * Internal not to be documented
+  */
+  namespace __detail__ {
+
+    //Hashes and compares keys dimension by dimension, so any type supported by geometricks::dimension::get can be a key.
+    template< typename Key >
+    struct __key_hash__ {
+
+      size_t
+      operator()( const Key& key ) const {
+        return __hash__( key, std::make_index_sequence<dimension::dimensional_traits<Key>::dimensions>{} );
+      }
+
+    private:
+
+      template< size_t... Is >
+      static size_t
+      __hash__( const Key& key, std::index_sequence<Is...> ) {
+        size_t seed = 0;
+        ( ( seed ^= std::hash<dimension::type_at<Key, Is>>{}( dimension::get( key, dimension::dimension_v<Is> ) ) + 0x9e3779b97f4a7c15ull + ( seed << 6 ) + ( seed >> 2 ) ), ... );
+        return seed;
+      }
+
+    };
+
+    template< typename Key >
+    struct __key_equal__ {
+
+      bool
+      operator()( const Key& lhs, const Key& rhs ) const {
+        return __equal__( lhs, rhs, std::make_index_sequence<dimension::dimensional_traits<Key>::dimensions>{} );
+      }
+
+    private:
+
+      template< size_t... Is >
+      static bool
+      __equal__( const Key& lhs, const Key& rhs, std::index_sequence<Is...> ) {
+        return ( ( dimension::get( lhs, dimension::dimension_v<Is> ) == dimension::get( rhs, dimension::dimension_v<Is> ) ) && ... );
+      }
+
+    };
+
+  }
+  /**
+  * @endcond
+  */
+
+  /**
+  * @brief Bounded least recently used cache of the nearest neighbor queries done on a kd tree.
+  * @tparam Tree The queried tree type, such as geometricks::kd_tree.
+  * @tparam DistanceFunction Point distance function object used by the queries. See geometricks::kd_tree::nearest_neighbor.
+  * @tparam KeyFunction Maps a query point to its cache key. Either geometricks::exact_point_key, geometricks::quantized_point_key or a user supplied function
+  * returning a type supported by geometricks::dimension::get whose dimensions are hashable.
+  * @details A hit returns the stored result without traversing the tree. A miss queries the tree and stores the result, evicting the least recently used one when the
+  * cache is full. The cache remembers the geometricks::kd_tree::generation of the tree and clears itself when the tree was rebuilt or assigned to.
+  *
+  * The cache holds a reference to the tree, which should outlive it. Unlike the queries of the tree, a query on the cache modifies it, so a cache shouldn't be
+  * shared between threads.
+  * Example:
+  * @code{.cpp}
+    geometricks::kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+    geometricks::kd_tree_cache cache{ tree, 1024 };
+    auto [nearest, distance] = cache.nearest_neighbor( std::make_tuple( 10, 10, 10 ) );
+    //Same result, without touching the tree.
+    auto [nearest_again, distance_again] = cache.nearest_neighbor( std::make_tuple( 10, 10, 10 ) );
+  * @endcode
+  */
+  template< typename Tree,
+            typename DistanceFunction = dimension::euclidean_distance,
+            typename KeyFunction = exact_point_key >
+  struct kd_tree_cache {
+
+  private:
+
+    using point_t = std::decay_t<decltype( std::declval<const Tree&>()[ 0 ] )>;
+
+    using distance_t = std::decay_t<decltype( std::declval<DistanceFunction&>()( std::declval<point_t>(), std::declval<point_t>() ) )>;
+
+    using key_t = std::decay_t<decltype( std::declval<const KeyFunction&>()( std::declval<const point_t&>() ) )>;
+
+  public:
+
+    /**
+    * @brief Constructs an empty cache in front of a tree.
+    * @param tree The tree to query. Should outlive the cache.
+    * @param capacity Maximum number of cached results. A capacity of 0 disables the cache.
+    * @param f Point distance function object used by the queries.
+    * @param key Key function object. See geometricks::quantized_point_key.
+    */
+    kd_tree_cache( const Tree& tree, size_t capacity, DistanceFunction f = DistanceFunction{}, KeyFunction key = KeyFunction{} ): m_tree( &tree ),
+                                                                                                                             m_capacity( capacity ),
+                                                                                                                             m_generation( tree.generation() ),
+                                                                                                                             m_distance_function( f ),
+                                                                                                                             m_key_function( key ) {
+      m_index.reserve( capacity );
+    }
+
+    /**
+    * @brief Finds the nearest neighbor of an input point, using the cached result if there is one.
+    * @param point The input point to query.
+    * @return A pair containing a reference to the nearest point and its distance to the input point. With a geometricks::quantized_point_key, a hit returns the
+    * result of the query that filled the cell, including its distance.
+    * @pre The tree is not empty.
+    * @note Complexity: @b O(1) on a hit, the cost of geometricks::kd_tree::nearest_neighbor on a miss.
+    */
+    std::pair<const point_t&, distance_t>
+    nearest_neighbor( const point_t& point ) {
+      if( m_generation != m_tree->generation() ) {
+        clear();
+        m_generation = m_tree->generation();
+      }
+      key_t key = m_key_function( point );
+      auto found = m_index.find( key );
+      if( found != m_index.end() ) {
+        ++m_hits;
+        m_entries.splice( m_entries.begin(), m_entries, found->second );
+        return { *found->second->m_nearest, found->second->m_distance };
+      }
+      ++m_misses;
+      auto [ nearest, distance ] = m_tree->nearest_neighbor( point, m_distance_function );
+      if( m_capacity > 0 ) {
+        if( m_entries.size() == m_capacity ) {
+          m_index.erase( m_entries.back().m_key );
+          m_entries.pop_back();
+        }
+        m_entries.push_front( entry_t{ key, &nearest, distance } );
+        m_index.emplace( std::move( key ), m_entries.begin() );
+      }
+      return { nearest, distance };
+    }
+
+    /**
+    * @brief Removes every cached result. The hit and miss counters are kept.
+    */
+    void
+    clear() noexcept {
+      m_index.clear();
+      m_entries.clear();
+    }
+
+    /**
+    * @brief Returns the number of queries answered from the cache.
+    */
+    int64_t
+    hits() const noexcept {
+      return m_hits;
+    }
+
+    /**
+    * @brief Returns the number of queries that had to search the tree.
+    */
+    int64_t
+    misses() const noexcept {
+      return m_misses;
+    }
+
+    /**
+    * @brief Returns the number of cached results.
+    */
+    size_t
+    size() const noexcept {
+      return m_entries.size();
+    }
+
+    /**
+    * @brief Returns the maximum number of cached results.
+    */
+    size_t
+    capacity() const noexcept {
+      return m_capacity;
+    }
+
+  private:
+
+    struct entry_t {
+
+      key_t m_key;
+
+      const point_t* m_nearest;
+
+      distance_t m_distance;
+
+    };
+
+    //Most recently used entries first.
+    using entry_list_t = std::list<entry_t>;
+
+    const Tree* m_tree;
+
+    size_t m_capacity;
+
+    uint64_t m_generation;
+
+    DistanceFunction m_distance_function;
+
+    KeyFunction m_key_function;
+
+    entry_list_t m_entries;
+
+    std::unordered_map<key_t, typename entry_list_t::iterator, __detail__::__key_hash__<key_t>, __detail__::__key_equal__<key_t>> m_index;
+
+    int64_t m_hits = 0;
+
+    int64_t m_misses = 0;
+
+  };
+
+  template< typename Tree >
+  kd_tree_cache( const Tree&, size_t ) -> kd_tree_cache<Tree>;
+
+  template< typename Tree, typename DistanceFunction >
+  kd_tree_cache( const Tree&, size_t, DistanceFunction ) -> kd_tree_cache<Tree, DistanceFunction>;
+
+  template< typename Tree, typename DistanceFunction, typename KeyFunction >
+  kd_tree_cache( const Tree&, size_t, DistanceFunction, KeyFunction ) -> kd_tree_cache<Tree, DistanceFunction, KeyFunction>;
+
+} //namespace geometricks
+
+#endif //GEOMETRICKS_DATA_STRUCTURE_KD_TREE_CACHE_HPP
@@ -0,0 +1,394 @@
+#ifndef GEOMETRICKS_DATA_STRUCTURE_QUANTIZED_KD_TREE_HPP
+#define GEOMETRICKS_DATA_STRUCTURE_QUANTIZED_KD_TREE_HPP
+
+//C stdlib includes
+#include <stdint.h>
+
+//C++ stdlib includes
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//Project includes
+#include "kd_tree.hpp"
+#include "dimensional_traits.hpp"
+#include "geometricks/memory/allocator.hpp"
+
+/**
+* @file Implements a kd tree storing its points as small fixed point codes.
+*/
+
+namespace geometricks {
+
+  /**
+  * @brief kd tree storing each coordinate as an unsigned integer code of a regular grid spanning the bounding box of the points.
+  * @tparam T The point type. Every dimension should be arithmetic, and T should be constructible from its coordinates with brace initialization, such as
+  * std::tuple<float, float, float> or std::array<float, 3>.
+  * @tparam Code Unsigned integer type of the codes, usually uint16_t or uint8_t.
+  * @tparam Traits Compile time configuration of the underlying tree. See geometricks::kd_tree_traits.
+  * @details Each point is stored as std::array<Code, N>, so a tree of 3D float points takes 6 bytes per point with 16 bit codes instead of 12, and 3 bytes
+  * with 8 bit codes. The grid has 2^bits - 1 steps per dimension, so a stored point is within half a step of its input point in every dimension, plus the
+  * rounding of the grid position to the coordinate type. See geometricks::quantized_kd_tree::max_error.
+  *
+  * Queries search the codes, pruning with bounds that account for the error of quantizing the query point, and compute the distance of the final candidates
+  * exactly, from the query point to the stored points. The results are the same as a geometricks::kd_tree built over the stored points would return, and
+  * distances are squared euclidean distances computed in double.
+  * Example:
+  * @code{.cpp}
+    std::vector<std::tuple<float, float, float>> input_vector;
+    ...
+    geometricks::quantized_kd_tree<std::tuple<float, float, float>> tree{ input_vector.begin(), input_vector.end() };
+    auto [nearest, distance] = tree.nearest_neighbor( std::make_tuple( 1.5f, 2.f, 0.25f ) );
+  * @endcode
+  */
+  template< typename T,
+            typename Code = uint16_t,
+            typename Traits = kd_tree_traits >
+  struct quantized_kd_tree {
+
+  private:
+
+    static constexpr int DATA_DIMENSIONS = dimension::dimensional_traits<T>::dimensions;
+
+    static_assert( std::is_unsigned_v<Code> && sizeof( Code ) <= 4, "Codes should be unsigned integers of at most 32 bits." );
+
+    static constexpr double MAX_CODE = static_cast<double>( std::numeric_limits<Code>::max() );
+
+  public:
+
+    ///Type stored in the underlying tree.
+    using code_type = std::array<Code, DATA_DIMENSIONS>;
+
+    /**
+    * @brief Constructs a quantized kd tree with a range of elements, using their bounding box as the extent of the grid.
+    * @param begin Forward iterator to first element of the input range.
+    * @param end Forward iterator to the last element of the input range.
+    * @param alloc Memory allocator to use. Defaults to the default allocator. See also geometricks::allocator.
+    * @details The input range is read twice and isn't modified. The codes are built in a temporary buffer before being laid out as a kd tree.
+    * @note Complexity: @b O(n log n)
+    */
+    template< typename ForwardIterator >
+    quantized_kd_tree( ForwardIterator begin, ForwardIterator end, geometricks::allocator alloc = geometricks::allocator{} ):
+      quantized_kd_tree( begin, end, __bounding_box__( begin, end ), alloc ) {
+    }
+
+    /**
+    * @brief Constructs a quantized kd tree with a range of elements inside a known box.
+    * @param begin Forward iterator to first element of the input range.
+    * @param end Forward iterator to the last element of the input range.
+    * @param min_corner Minimum values of the box.
+    * @param max_corner Maximum values of the box.
+    * @param alloc Memory allocator to use. Defaults to the default allocator. See also geometricks::allocator.
+    * @pre Every input point lies within the box. Points outside of it are clamped to its boundary.
+    * @details Fixing the box keeps the step of the grid, and so the precision, independent of the input.
+    * @note Complexity: @b O(n log n)
+    */
+    template< typename ForwardIterator >
+    quantized_kd_tree( ForwardIterator begin, ForwardIterator end, const T& min_corner, const T& max_corner, geometricks::allocator alloc = geometricks::allocator{} ):
+      quantized_kd_tree( begin, end, std::make_pair( __coordinates__( min_corner ), __coordinates__( max_corner ) ), alloc ) {
+    }
+
+    /**
+    * @brief Finds the nearest stored point of an input point.
+    * @param point The input point to query.
+    * @return A pair containing the nearest stored point and its squared euclidean distance to the input point.
+    * @pre The tree is not empty.
+    */
+    std::pair<T, double>
+    nearest_neighbor( const T& point ) const {
+      return k_nearest_neighbor( point, 1 ).front();
+    }
+
+    /**
+    * @brief Finds the k nearest stored points of an input point.
+    * @param point The input point to query.
+    * @param K the number of desired output points.
+    * @return A vector containing the nearest stored points and their squared euclidean distances to the input point, in ascending order.
+    * @details Walks the codes with geometricks::kd_tree::ranked_nearest_neighbors, by increasing distance to the quantized query point. The distance between the
+    * query point and its quantized counterpart bounds how much closer to the query a stored point can be, so the search stops as soon as the next code is
+    * further than the K-th exact distance by more than that.
+    */
+    std::vector<std::pair<T, double>>
+    k_nearest_neighbor( const T& point, uint32_t K ) const {
+      std::vector<std::pair<T, double>> output_col;
+      if( K == 0 || m_tree.size() == 0 ) {
+        return output_col;
+      }
+      auto coordinates = __coordinates__( point );
+      code_type query = __quantize__( coordinates );
+      //Distances between codes are measured between grid positions, which the stored points differ from by up to the rounding to the coordinate type.
+      double query_error = std::sqrt( __grid_distance__( coordinates, query ) ) + m_rounding_error;
+      auto heap_compare = []( const std::pair<T, double>& lhs, const std::pair<T, double>& rhs ) {
+        return lhs.second < rhs.second;
+      };
+      output_col.reserve( K );
+      for( auto [ candidate, code_distance ] : m_tree.ranked_nearest_neighbors( query, m_distance_function ) ) {
+        if( output_col.size() == K && std::sqrt( code_distance ) - query_error > std::sqrt( output_col.front().second ) ) {
+          break;
+        }
+        //The distance is measured to the point as T holds it, which is what the caller gets back.
+        T stored = __to_point__( candidate );
+        double distance = __squared_distance__( coordinates, stored, std::make_index_sequence<DATA_DIMENSIONS>{} );
+        if( output_col.size() < K ) {
+          output_col.emplace_back( stored, distance );
+          std::push_heap( output_col.begin(), output_col.end(), heap_compare );
+        }
+        else if( distance < output_col.front().second ) {
+          std::pop_heap( output_col.begin(), output_col.end(), heap_compare );
+          output_col.back() = std::make_pair( stored, distance );
+          std::push_heap( output_col.begin(), output_col.end(), heap_compare );
+        }
+      }
+      std::sort_heap( output_col.begin(), output_col.end(), heap_compare );
+      return output_col;
+    }
+
+    /**
+    * @brief Performs a range query on the collection.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @return Vector containing all stored points in range.
+    * @details The box is widened to the enclosing grid cells to search the codes, and the stored points found are then checked against the exact box.
+    * As with geometricks::kd_tree::range_search, min_point and max_point don't need to be sorted.
+    */
+    std::vector<T>
+    range_search( const T& min_point, const T& max_point ) const {
+      std::vector<T> output_col;
+      if( m_tree.size() == 0 ) {
+        return output_col;
+      }
+      auto min_coordinates = __coordinates__( min_point );
+      auto max_coordinates = __coordinates__( max_point );
+      code_type min_code;
+      code_type max_code;
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        if( max_coordinates[ i ] < min_coordinates[ i ] ) {
+          std::swap( min_coordinates[ i ], max_coordinates[ i ] );
+        }
+        double rounding = __rounding_error__( i );
+        min_code[ i ] = static_cast<Code>( std::clamp( std::floor( ( min_coordinates[ i ] - rounding - m_origin[ i ] ) / m_step[ i ] ), 0.0, MAX_CODE ) );
+        max_code[ i ] = static_cast<Code>( std::clamp( std::ceil( ( max_coordinates[ i ] + rounding - m_origin[ i ] ) / m_step[ i ] ), 0.0, MAX_CODE ) );
+      }
+      for( const code_type& code : m_tree.lazy_range_search( min_code, max_code ) ) {
+        T candidate = __to_point__( code );
+        if( __is_inside__( __coordinates__( candidate ), min_coordinates, max_coordinates ) ) {
+          output_col.push_back( candidate );
+        }
+      }
+      return output_col;
+    }
+
+    /**
+    * @brief Returns the largest difference, in each dimension, between an input point and the point stored for it, which is half a step of the grid.
+    */
+    std::array<double, DATA_DIMENSIONS>
+    max_error() const noexcept {
+      std::array<double, DATA_DIMENSIONS> output;
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        output[ i ] = m_step[ i ] / 2 + __rounding_error__( i );
+      }
+      return output;
+    }
+
+    /**
+    * @brief Returns the number of stored points.
+    */
+    int32_t
+    size() const noexcept {
+      return m_tree.size();
+    }
+
+    /**
+    * @brief Returns the underlying tree of codes.
+    */
+    const kd_tree<code_type, std::less<>, Traits>&
+    codes() const noexcept {
+      return m_tree;
+    }
+
+  private:
+
+    using coordinates_t = std::array<double, DATA_DIMENSIONS>;
+
+    //Position of code 0 and size of a step of the grid, in each dimension.
+    coordinates_t m_origin;
+
+    coordinates_t m_step;
+
+    //Squared euclidean distance in the space of the codes, scaled back to the units of T.
+    dimension::weighted_euclidean_distance<DATA_DIMENSIONS, double> m_distance_function;
+
+    kd_tree<code_type, std::less<>, Traits> m_tree;
+
+    //Upper bound of the euclidean distance between a grid position and its conversion to T.
+    double m_rounding_error;
+
+    template< typename ForwardIterator >
+    quantized_kd_tree( ForwardIterator begin, ForwardIterator end, const std::pair<coordinates_t, coordinates_t>& box, geometricks::allocator alloc ):
+      m_origin( box.first ),
+      m_step( __steps__( box ) ),
+      m_distance_function( __squared__( m_step ) ),
+      m_tree( __build__( begin, end, alloc ) ) {
+      double squared_error = 0;
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        squared_error += __rounding_error__( i ) * __rounding_error__( i );
+      }
+      m_rounding_error = std::sqrt( squared_error );
+    }
+
+    template< typename ForwardIterator >
+    kd_tree<code_type, std::less<>, Traits>
+    __build__( ForwardIterator begin, ForwardIterator end, geometricks::allocator alloc ) const {
+      std::vector<code_type> codes;
+      codes.reserve( std::distance( begin, end ) );
+      for( ; begin != end; ++begin ) {
+        codes.push_back( __quantize__( __coordinates__( *begin ) ) );
+      }
+      return kd_tree<code_type, std::less<>, Traits>{ codes.begin(), codes.end(), std::less<>{}, alloc };
+    }
+
+    template< typename ForwardIterator >
+    static std::pair<coordinates_t, coordinates_t>
+    __bounding_box__( ForwardIterator begin, ForwardIterator end ) {
+      coordinates_t min_coordinates;
+      coordinates_t max_coordinates;
+      min_coordinates.fill( std::numeric_limits<double>::max() );
+      max_coordinates.fill( std::numeric_limits<double>::lowest() );
+      if( begin == end ) {
+        min_coordinates.fill( 0 );
+        max_coordinates.fill( 0 );
+      }
+      for( ; begin != end; ++begin ) {
+        auto coordinates = __coordinates__( *begin );
+        for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+          min_coordinates[ i ] = std::min( min_coordinates[ i ], coordinates[ i ] );
+          max_coordinates[ i ] = std::max( max_coordinates[ i ], coordinates[ i ] );
+        }
+      }
+      return { min_coordinates, max_coordinates };
+    }
+
+    static coordinates_t
+    __steps__( const std::pair<coordinates_t, coordinates_t>& box ) {
+      coordinates_t output;
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        double extent = box.second[ i ] - box.first[ i ];
+        output[ i ] = extent > 0 ? extent / MAX_CODE : 1.0;
+      }
+      return output;
+    }
+
+    static std::array<double, DATA_DIMENSIONS>
+    __squared__( const coordinates_t& values ) {
+      std::array<double, DATA_DIMENSIONS> output;
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        output[ i ] = values[ i ] * values[ i ];
+      }
+      return output;
+    }
+
+    static coordinates_t
+    __coordinates__( const T& point ) {
+      return __coordinates__( point, std::make_index_sequence<DATA_DIMENSIONS>{} );
+    }
+
+    template< size_t... Is >
+    static coordinates_t
+    __coordinates__( const T& point, std::index_sequence<Is...> ) {
+      static_assert( ( std::is_arithmetic_v<dimension::type_at<T, Is>> && ... ), "Quantized trees need arithmetic coordinates." );
+      return { static_cast<double>( dimension::get( point, dimension::dimension_v<Is> ) )... };
+    }
+
+    code_type
+    __quantize__( const coordinates_t& coordinates ) const {
+      code_type output;
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        output[ i ] = static_cast<Code>( std::clamp( std::round( ( coordinates[ i ] - m_origin[ i ] ) / m_step[ i ] ), 0.0, MAX_CODE ) );
+      }
+      return output;
+    }
+
+    T
+    __to_point__( const code_type& code ) const {
+      return __to_point__( code, std::make_index_sequence<DATA_DIMENSIONS>{} );
+    }
+
+    template< size_t... Is >
+    T
+    __to_point__( const code_type& code, std::index_sequence<Is...> ) const {
+      return T{ __convert__<dimension::type_at<T, Is>>( m_origin[ Is ] + code[ Is ] * m_step[ Is ] )... };
+    }
+
+    template< typename Coordinate >
+    static Coordinate
+    __convert__( double value ) {
+      if constexpr( std::is_integral_v<Coordinate> ) {
+        return static_cast<Coordinate>( std::llround( value ) );
+      }
+      else {
+        return static_cast<Coordinate>( value );
+      }
+    }
+
+    //Largest difference between a grid position in dimension index and its conversion to the coordinate type: integers are rounded to the nearest value, and
+    //floating point types lose the low bits of the largest magnitude of the grid.
+    double
+    __rounding_error__( int index ) const noexcept {
+      double output = 0;
+      __detail__::dispatch_dimension<DATA_DIMENSIONS>( index, [ this, &output ]( auto ic ) {
+        using coordinate_t = dimension::type_at<T, decltype( ic )::value>;
+        int i = decltype( ic )::value;
+        if constexpr( std::is_integral_v<coordinate_t> ) {
+          output = 0.5;
+        }
+        else {
+          double magnitude = std::max( std::abs( m_origin[ i ] ), std::abs( m_origin[ i ] + MAX_CODE * m_step[ i ] ) );
+          output = magnitude * static_cast<double>( std::numeric_limits<coordinate_t>::epsilon() );
+        }
+      } );
+      return output;
+    }
+
+    //Squared euclidean distance between a point and the grid position of a code.
+    double
+    __grid_distance__( const coordinates_t& coordinates, const code_type& code ) const {
+      double output = 0;
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        double difference = coordinates[ i ] - ( m_origin[ i ] + code[ i ] * m_step[ i ] );
+        output += difference * difference;
+      }
+      return output;
+    }
+
+    //Squared euclidean distance between a point and a stored point, as T holds it.
+    template< size_t... Is >
+    static double
+    __squared_distance__( const coordinates_t& coordinates, const T& point, std::index_sequence<Is...> ) {
+      return ( __squared__( coordinates[ Is ] - static_cast<double>( dimension::get( point, dimension::dimension_v<Is> ) ) ) + ... );
+    }
+
+    static double
+    __squared__( double value ) {
+      return value * value;
+    }
+
+    static bool
+    __is_inside__( const coordinates_t& coordinates, const coordinates_t& min_coordinates, const coordinates_t& max_coordinates ) {
+      for( int i = 0; i < DATA_DIMENSIONS; ++i ) {
+        if( coordinates[ i ] < min_coordinates[ i ] || coordinates[ i ] > max_coordinates[ i ] ) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+  };
+
+} //namespace geometricks
+
+#endif //GEOMETRICKS_DATA_STRUCTURE_QUANTIZED_KD_TREE_HPP
@@ -0,0 +1,434 @@
+#ifndef GEOMETRICKS_DATA_STRUCTURE_SHARDED_KD_TREE_HPP
+#define GEOMETRICKS_DATA_STRUCTURE_SHARDED_KD_TREE_HPP
+
+//C stdlib includes
+#include <stdint.h>
+
+//C++ stdlib includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//Project includes
+#include "kd_tree.hpp"
+#include "dimensional_traits.hpp"
+#include "geometricks/meta/utils.hpp"
+#include "geometricks/memory/allocator.hpp"
+
+/**
+* @file Implements a kd tree split into independent shards by spatial region.
+*/
+
+namespace geometricks {
+
+  /**
+  * @brief Spatial index made of independent geometricks::kd_tree shards, each owning a region of space.
+  * @tparam T The stored data type. Should be default constructible, since each shard keeps copies of the points on its bounding box.
+  * @tparam Compare Function that compares the data types stored in each dimension of the data. See geometricks::kd_tree.
+  * @tparam Traits Compile time configuration of each shard. See geometricks::kd_tree_traits.
+  * @details The input is split into shard_count regions of roughly the same number of points by a few median splits cycling through the dimensions, like
+  * the top levels of a kd tree. Each region gets its own kd tree, so there is one allocation per shard instead of a single huge one, and the shards are built
+  * and rebuilt in parallel.
+  *
+  * Every shard keeps the bounding box of its points. Queries visit the shards in order of the distance from the query point to their boxes and skip the ones that
+  * can't contain a result: nearest neighbor queries pass the current K-th distance to the next shard as the cutoff of its search and merge the results,
+  * and range queries only visit the shards whose box intersects the query box.
+  *
+  * A shard can be rebuilt on its own with geometricks::sharded_kd_tree::rebuild_shard, for example when the data of its region changed. Since the queries
+  * only rely on the bounding boxes, a rebuilt shard may hold points outside of its original region. Use geometricks::sharded_kd_tree::shard_of to find the
+  * region of a point.
+  * Example:
+  * @code{.cpp}
+    std::vector<std::tuple<int, int, int>> input_vector;
+    ...
+    geometricks::sharded_kd_tree<std::tuple<int, int, int>> index{ input_vector.begin(), input_vector.end(), 64 };
+    auto nearest = index.k_nearest_neighbor( std::make_tuple( 10, 10, 10 ), 8 );
+    auto in_range = index.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 50, 50, 50 ) );
+  * @endcode
+  */
+  template< typename T,
+            typename Compare = std::less<>,
+            typename Traits = kd_tree_traits >
+  struct sharded_kd_tree : private Compare {
+
+    ///Type of each shard.
+    using shard_type = kd_tree<T, Compare, Traits>;
+
+    /**
+    * @brief Constructs a sharded kd tree with a range of elements.
+    * @param begin Random access iterator to first element of the input range.
+    * @param end Random access iterator to the last element of the input range.
+    * @param shard_count Number of shards to split the points into.
+    * @param comp Compare function to use for the shards. If not supplied, default constructs it.
+    * @param alloc Memory allocator used by the shards. Defaults to the default allocator. See also geometricks::allocator.
+    * @param thread_count Number of threads used to build the shards. Defaults to the number of hardware threads.
+    * @details Like geometricks::kd_tree, the input range is reordered during the construction.
+    * @note Complexity: @b O(n log n)
+    */
+    template< typename RandomAccessIterator >
+    sharded_kd_tree( RandomAccessIterator begin,
+                     RandomAccessIterator end,
+                     int32_t shard_count,
+                     Compare comp = Compare{},
+                     geometricks::allocator alloc = geometricks::allocator{},
+                     uint32_t thread_count = std::thread::hardware_concurrency() ): Compare( comp ) {
+      shard_count = std::max( shard_count, 1 );
+      m_shards.reserve( shard_count );
+      for( int32_t i = 0; i < shard_count; ++i ) {
+        m_shards.push_back( shard_t{ shard_type{ begin, begin, comp, alloc }, {}, {} } );
+      }
+      rebuild( begin, end, thread_count );
+    }
+
+    /**
+    * @brief Rebuilds every shard with a new range of elements.
+    * @param begin Random access iterator to first element of the input range.
+    * @param end Random access iterator to the last element of the input range.
+    * @param thread_count Number of threads used to build the shards. Defaults to the number of hardware threads.
+    * @details Splits the space again with the new points and rebuilds the shards in parallel, reusing their storage. See geometricks::kd_tree::rebuild.
+    * @note Complexity: @b O(n log n)
+    */
+    template< typename RandomAccessIterator >
+    void
+    rebuild( RandomAccessIterator begin, RandomAccessIterator end, uint32_t thread_count = std::thread::hardware_concurrency() ) {
+      m_splits.clear();
+      std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>> ranges( m_shards.size() );
+      __split__<0>( begin, end, 0, static_cast<int32_t>( m_shards.size() ), ranges );
+      std::atomic<size_t> next_shard{ 0 };
+      auto worker = [&]() {
+        for( size_t index = next_shard++; index < m_shards.size(); index = next_shard++ ) {
+          m_shards[ index ].m_tree.rebuild( ranges[ index ].first, ranges[ index ].second );
+          __compute_bounds__( m_shards[ index ], std::make_index_sequence<DATA_DIMENSIONS>{} );
+        }
+      };
+      std::vector<std::thread> threads;
+      size_t thread_total = std::min<size_t>( std::max( thread_count, 1u ), m_shards.size() );
+      threads.reserve( thread_total );
+      for( size_t i = 1; i < thread_total; ++i ) {
+        threads.emplace_back( worker );
+      }
+      worker();
+      for( auto& thread : threads ) {
+        thread.join();
+      }
+    }
+
+    /**
+    * @brief Rebuilds a single shard with a new range of elements, leaving the other shards untouched.
+    * @param index Index of the shard. Should be in the range [ 0, shard_count() ).
+    * @param begin Iterator to first element of the input range.
+    * @param end Iterator to the last element of the input range or sentinel value.
+    * @details The points don't have to lie in the original region of the shard, but queries are faster when they do. See geometricks::sharded_kd_tree::shard_of.
+    * @note Complexity: @b O(m log m), where m is the number of points of the shard.
+    */
+    template< typename InputIterator, typename Sentinel >
+    void
+    rebuild_shard( int32_t index, InputIterator begin, Sentinel end ) {
+      m_shards[ index ].m_tree.rebuild( begin, end );
+      __compute_bounds__( m_shards[ index ], std::make_index_sequence<DATA_DIMENSIONS>{} );
+    }
+
+    /**
+    * @brief Returns the index of the shard whose original region contains a point.
+    * @param point The point.
+    * @details Follows the splits computed by the last call to the constructor or to geometricks::sharded_kd_tree::rebuild. Points equal to a splitting point
+    * in its splitting dimension always go to its right side, so for the points of the last build this is the shard that holds them.
+    */
+    int32_t
+    shard_of( const T& point ) const {
+      int32_t node = m_splits.empty() ? ~0 : 0;
+      while( node >= 0 ) {
+        const split_t& split = m_splits[ node ];
+        bool is_left = false;
+        __detail__::dispatch_dimension<DATA_DIMENSIONS>( split.m_dimension, [&]( auto dimension ) {
+          is_left = __less__<decltype( dimension )::value>( point, split.m_point );
+        } );
+        node = is_left ? split.m_left : split.m_right;
+      }
+      return ~node;
+    }
+
+    /**
+    * @brief Finds the nearest neighbor of an input point.
+    * @param point The input point to query.
+    * @param f Point distance function object. See geometricks::kd_tree::nearest_neighbor.
+    * @return A pair containing a reference to the nearest point and its distance to the input point.
+    * @pre The tree is not empty.
+    */
+    template< typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    nearest_neighbor( const T& point, DistanceFunction f = DistanceFunction{} ) const {
+      auto nearest = __k_nearest_neighbor_search__( point, 1, f );
+      return std::pair<const T&, __distance_t__<DistanceFunction>>( *nearest[ 0 ].first, nearest[ 0 ].second );
+    }
+
+    /**
+    * @brief Finds the k nearest neighbors of an input point.
+    * @param point The input point to query.
+    * @param K the number of desired output points.
+    * @param f Point distance function object. See geometricks::kd_tree::nearest_neighbor.
+    * @return A vector containing the output points as well as the distance calculated from the input point, in ascending order.
+    * @details When the distance type is arithmetic, each shard is searched with the current K-th distance as its cutoff, see the bounded overload of
+    * geometricks::kd_tree::k_nearest_neighbor.
+    */
+    template< typename DistanceFunction = dimension::euclidean_distance >
+    auto
+    k_nearest_neighbor( const T& point, uint32_t K, DistanceFunction f = DistanceFunction{} ) const ->
+    std::vector<std::pair<T, std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>>> {
+      std::vector<std::pair<T, __distance_t__<DistanceFunction>>> output_col;
+      auto nearest = __k_nearest_neighbor_search__( point, K, f );
+      output_col.reserve( nearest.size() );
+      for( auto& element : nearest ) {
+        output_col.emplace_back( *element.first, element.second );
+      }
+      return output_col;
+    }
+
+    /**
+    * @brief Performs a range query on the collection.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @return Vector containing all points in range, grouped by shard.
+    * @details Only the shards whose bounding box intersects the query box are searched. See geometricks::kd_tree::range_search.
+    */
+    std::vector<T>
+    range_search( T min_point, T max_point ) const {
+      std::vector<T> output_col;
+      __organize_data__( min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>{} );
+      for( auto& shard : m_shards ) {
+        if( shard.m_tree.size() > 0 && __intersects__( shard, min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>{} ) ) {
+          auto shard_output = shard.m_tree.range_search( min_point, max_point );
+          std::move( shard_output.begin(), shard_output.end(), std::back_inserter( output_col ) );
+        }
+      }
+      return output_col;
+    }
+
+    /**
+    * @brief Returns the number of points stored in all shards.
+    */
+    int32_t
+    size() const noexcept {
+      int32_t total = 0;
+      for( auto& shard : m_shards ) {
+        total += shard.m_tree.size();
+      }
+      return total;
+    }
+
+    /**
+    * @brief Returns the number of shards.
+    */
+    int32_t
+    shard_count() const noexcept {
+      return static_cast<int32_t>( m_shards.size() );
+    }
+
+    /**
+    * @brief Accesses a shard.
+    * @param index Index of the shard. Should be in the range [ 0, shard_count() ).
+    */
+    const shard_type&
+    shard( int32_t index ) const noexcept {
+      return m_shards[ index ].m_tree;
+    }
+
+  private:
+
+    static constexpr int DATA_DIMENSIONS = dimension::dimensional_traits<T>::dimensions;
+
+    template< typename DistanceFunction >
+    using __distance_t__ = std::decay_t<decltype( std::declval<DistanceFunction&>()( std::declval<T>(), std::declval<T>() ) )>;
+
+    struct shard_t {
+
+      shard_type m_tree;
+
+      //Copies of the points with the smallest and largest value of each dimension. They are kept by value because a shard with deferred subtrees reorders its
+      //points while it is being queried. See geometricks::kd_tree_traits::lazy_subtree_size.
+      std::array<T, DATA_DIMENSIONS> m_lower;
+
+      std::array<T, DATA_DIMENSIONS> m_upper;
+
+    };
+
+    //Median split of the top levels. Children are indices in m_splits, or the complement of a shard index if negative.
+    struct split_t {
+
+      int32_t m_dimension;
+
+      T m_point;
+
+      int32_t m_left;
+
+      int32_t m_right;
+
+    };
+
+    std::vector<shard_t> m_shards;
+
+    std::vector<split_t> m_splits;
+
+    template< int Dimension >
+    bool
+    __less__( const T& lhs, const T& rhs ) const {
+      return Compare::operator()( dimension::get( lhs, dimension::dimension_v<Dimension> ), dimension::get( rhs, dimension::dimension_v<Dimension> ) );
+    }
+
+    //Splits [ begin, end ) among the shards [ first_shard, first_shard + shard_count ), giving each side a number of points proportional to its number of shards.
+    //Returns the node to link from the parent.
+    template< int Dimension, typename RandomAccessIterator >
+    int32_t
+    __split__( RandomAccessIterator begin, RandomAccessIterator end, int32_t first_shard, int32_t shard_count, std::vector<std::pair<RandomAccessIterator, RandomAccessIterator>>& ranges ) {
+      //Without points there is nothing to split on, so every shard of the block is left empty and the block is routed to its first shard.
+      if( shard_count == 1 || begin == end ) {
+        for( int32_t i = 0; i < shard_count; ++i ) {
+          ranges[ first_shard + i ] = { begin, end };
+        }
+        return ~first_shard;
+      }
+      constexpr int NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
+      int32_t left_count = shard_count >> 1;
+      auto middle = begin + static_cast<std::ptrdiff_t>( ( end - begin ) * static_cast<int64_t>( left_count ) / shard_count );
+      std::nth_element( begin, middle, end, [this]( const T& lhs, const T& rhs ) {
+        return __less__<Dimension>( lhs, rhs );
+      } );
+      int32_t node = static_cast<int32_t>( m_splits.size() );
+      m_splits.push_back( split_t{ Dimension, *middle, 0, 0 } );
+      //Points equal to the splitting point may have been selected before it, so move them to the right side, where shard_of routes them.
+      middle = std::partition( begin, middle, [ this, &split_point = m_splits.back().m_point ]( const T& point ) {
+        return __less__<Dimension>( point, split_point );
+      } );
+      int32_t left = __split__<NextDimension>( begin, middle, first_shard, left_count, ranges );
+      int32_t right = __split__<NextDimension>( middle, end, first_shard + left_count, shard_count - left_count, ranges );
+      m_splits[ node ].m_left = left;
+      m_splits[ node ].m_right = right;
+      return node;
+    }
+
+    template< size_t... Is >
+    void
+    __compute_bounds__( shard_t& shard, std::index_sequence<Is...> ) const {
+      if( shard.m_tree.size() == 0 ) {
+        return;
+      }
+      shard.m_lower.fill( shard.m_tree[ 0 ] );
+      shard.m_upper.fill( shard.m_tree[ 0 ] );
+      for( int32_t index = 1; index < shard.m_tree.size(); ++index ) {
+        ( __expand_bounds__<Is>( shard, index ), ... );
+      }
+    }
+
+    template< int Dimension >
+    void
+    __expand_bounds__( shard_t& shard, int32_t index ) const {
+      const T& point = shard.m_tree[ index ];
+      if( __less__<Dimension>( point, shard.m_lower[ Dimension ] ) ) {
+        shard.m_lower[ Dimension ] = point;
+      }
+      if( __less__<Dimension>( shard.m_upper[ Dimension ], point ) ) {
+        shard.m_upper[ Dimension ] = point;
+      }
+    }
+
+    //Lower bound of the distance from point to any point of the shard. Uses the largest per dimension distance to the bounding box, which only assumes,
+    //like geometricks::kd_tree, that the distance in a single dimension never exceeds the full distance.
+    template< typename DistanceFunction, size_t... Is >
+    __distance_t__<DistanceFunction>
+    __distance_to_box__( const shard_t& shard, const T& point, DistanceFunction& f, std::index_sequence<Is...> ) const {
+      __distance_t__<DistanceFunction> bound{};
+      ( __expand_distance_to_box__<Is>( shard, point, f, bound ), ... );
+      return bound;
+    }
+
+    template< int Dimension, typename DistanceFunction >
+    void
+    __expand_distance_to_box__( const shard_t& shard, const T& point, DistanceFunction& f, __distance_t__<DistanceFunction>& bound ) const {
+      using distance_t = __distance_t__<DistanceFunction>;
+      const T& lower = shard.m_lower[ Dimension ];
+      const T& upper = shard.m_upper[ Dimension ];
+      if( __less__<Dimension>( point, lower ) ) {
+        bound = std::max( bound, static_cast<distance_t>( __detail__::dimension_distance<Dimension>( f, point, lower ) ) );
+      }
+      else if( __less__<Dimension>( upper, point ) ) {
+        bound = std::max( bound, static_cast<distance_t>( __detail__::dimension_distance<Dimension>( f, point, upper ) ) );
+      }
+    }
+
+    template< size_t... Is >
+    bool
+    __intersects__( const shard_t& shard, const T& min_point, const T& max_point, std::index_sequence<Is...> ) const {
+      return ( ( !__less__<Is>( max_point, shard.m_lower[ Is ] ) && !__less__<Is>( shard.m_upper[ Is ], min_point ) ) && ... );
+    }
+
+    template< size_t... Is >
+    void
+    __organize_data__( T& first, T& second, std::index_sequence<Is...> ) const {
+      ( __swap_if_greater__( dimension::get( first, dimension::dimension_v<Is> ), dimension::get( second, dimension::dimension_v<Is> ) ), ... );
+    }
+
+    template< typename DataType >
+    void
+    __swap_if_greater__( DataType& first, DataType& second ) const {
+      if( !Compare::operator()( first, second ) ) {
+        using std::swap;
+        swap( first, second );
+      }
+    }
+
+    //Visits the shards closest first. Each shard is searched with the K-th distance found so far as its cutoff and its results are merged into the output,
+    //stopping at the first shard whose box is further than that distance.
+    template< typename DistanceFunction >
+    std::vector<std::pair<const T*, __distance_t__<DistanceFunction>>>
+    __k_nearest_neighbor_search__( const T& point, uint32_t K, DistanceFunction& f ) const {
+      using distance_t = __distance_t__<DistanceFunction>;
+      std::vector<std::pair<const T*, distance_t>> output_col;
+      if( K == 0 ) {
+        return output_col;
+      }
+      std::vector<std::pair<distance_t, const shard_type*>> order;
+      order.reserve( m_shards.size() );
+      for( auto& shard : m_shards ) {
+        if( shard.m_tree.size() > 0 ) {
+          order.emplace_back( __distance_to_box__( shard, point, f, std::make_index_sequence<DATA_DIMENSIONS>{} ), &shard.m_tree );
+        }
+      }
+      std::sort( order.begin(), order.end(), []( const auto& lhs, const auto& rhs ) {
+        return lhs.first < rhs.first;
+      } );
+      auto closer = []( const std::pair<const T*, distance_t>& lhs, const std::pair<const T*, distance_t>& rhs ) {
+        return lhs.second < rhs.second;
+      };
+      for( auto& [ box_distance, tree ] : order ) {
+        if( output_col.size() == K && output_col.back().second < box_distance ) {
+          break;
+        }
+        size_t previous_size = output_col.size();
+        if constexpr( std::is_arithmetic_v<distance_t> ) {
+          distance_t bound = output_col.size() == K ? output_col.back().second : meta::numeric_limits<distance_t>::max();
+          auto shard_output = tree->k_nearest_neighbor_ptr( point, K, bound, f );
+          output_col.insert( output_col.end(), shard_output.begin(), shard_output.end() );
+        }
+        else {
+          auto shard_output = tree->k_nearest_neighbor_ptr( point, K, f );
+          output_col.insert( output_col.end(), shard_output.begin(), shard_output.end() );
+        }
+        std::inplace_merge( output_col.begin(), output_col.begin() + previous_size, output_col.end(), closer );
+        if( output_col.size() > K ) {
+          output_col.resize( K );
+        }
+      }
+      return output_col;
+    }
+
+  };
+
+} //namespace geometricks
+
+#endif //GEOMETRICKS_DATA_STRUCTURE_SHARDED_KD_TREE_HPP
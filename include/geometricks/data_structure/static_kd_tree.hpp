@@ -0,0 +1,362 @@
+#ifndef GEOMETRICKS_DATA_STRUCTURE_STATIC_KD_TREE_HPP
+#define GEOMETRICKS_DATA_STRUCTURE_STATIC_KD_TREE_HPP
+
+//C stdlib includes
+#include <stdint.h>
+
+//C++ stdlib includes
+#include <array>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+//Project includes
+#include "dimensional_traits.hpp"
+#include "geometricks/meta/utils.hpp"
+
+/**
+* @file Implements a fixed capacity kd tree that can be built and queried at compile time.
+*/
+
+namespace geometricks {
+
+  /**
+  * @brief Fixed capacity kd tree whose construction and queries are constexpr.
+  * @tparam T The stored data type. Should be a literal type and default constructible. For compile time use, T should also be assignable in a constant expression,
+  * which rules out std::tuple and std::pair before C++20. std::array and user defined aggregates work.
+  * @tparam N The number of stored points.
+  * @tparam Compare Function that compares the data stored in each dimension of T. See geometricks::kd_tree.
+  * @details Stores the points in a std::array with the same implicit layout as geometricks::kd_tree. Declaring the tree as a constexpr variable builds it
+  * during compilation, so fixed lookup tables, like color palettes or calibration points, end up in the read only data of the binary without any startup cost.
+  * The same tree can also be built and queried at runtime.
+  *
+  * Example:
+  * @code{.cpp}
+    using color_t = std::array<int, 3>;
+    constexpr std::array<color_t, 4> palette{ { { 0, 0, 0 }, { 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 } } };
+    constexpr geometricks::static_kd_tree tree{ palette };
+    static_assert( tree.nearest_neighbor( color_t{ 200, 10, 10 } ).first == color_t{ 255, 0, 0 } );
+  * @endcode
+  * @note Compile time evaluation is bounded by the compiler limits on constant evaluation, e.g. -fconstexpr-ops-limit on GCC and -fconstexpr-steps on clang.
+  * About 2000 points fit in the default limit of GCC, whether or not their coordinates repeat.
+  * @note The distance functions used in a constant expression must be constexpr. geometricks::dimension::euclidean_distance is.
+  */
+  template< typename T,
+            size_t N,
+            typename Compare = std::less<> >
+  struct static_kd_tree : private Compare {
+
+    /**
+    * @brief Constructs the tree from an array of points.
+    * @param points The points to store.
+    * @param comp Compare function to use for the kd tree. If not supplied, default constructs it.
+    * @note Complexity: @b O(n log n) on average.
+    */
+    constexpr static_kd_tree( const std::array<T, N>& points, Compare comp = Compare{} ): Compare( comp ),
+                                                                                          m_data_array{} {
+      std::array<T, N> scratch = points;
+      __construct_kd_tree__<0>( scratch, 0, static_cast<int32_t>( N ), 0 );
+    }
+
+    /**
+    * @brief Finds the nearest neighbor of an input point.
+    * @param point The input point to query.
+    * @param f Point distance function object. See geometricks::kd_tree::nearest_neighbor.
+    * @return A pair containing the nearest point and its distance to the input point.
+    */
+    template< typename DistanceFunction = dimension::euclidean_distance >
+    constexpr auto
+    nearest_neighbor( const T& point, DistanceFunction f = DistanceFunction{} ) const {
+      static_assert( N > 0, "Nearest neighbor queries need at least 1 point." );
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      distance_t best = meta::numeric_limits<distance_t>::max();
+      int32_t closest = 0;
+      __nearest_neighbor_impl__<0>( point, __root__(), closest, best, f );
+      return std::pair<const T&, distance_t>( m_data_array[ closest ], best );
+    }
+
+    /**
+    * @brief Finds the K nearest neighbors of an input point.
+    * @tparam K The number of desired output points. Should be at most N.
+    * @param point The input point to query.
+    * @param f Point distance function object. See geometricks::kd_tree::k_nearest_neighbor.
+    * @return An array containing the output points as well as their distance to the input point, in ascending order.
+    */
+    template< size_t K, typename DistanceFunction = dimension::euclidean_distance >
+    constexpr auto
+    k_nearest_neighbor( const T& point, DistanceFunction f = DistanceFunction{} ) const {
+      static_assert( K <= N, "Can't find more neighbors than there are points." );
+      using distance_t = std::decay_t<decltype(f( std::declval<T>(), std::declval<T>() ))>;
+      std::array<__candidate__<distance_t>, K> best{};
+      size_t count = 0;
+      __k_nearest_neighbor_impl__<0>( point, __root__(), best, count, f );
+      std::array<std::pair<T, distance_t>, K> output_col{};
+      for( size_t i = 0; i < K; ++i ) {
+        output_col[ i ].first = m_data_array[ best[ i ].m_index ];
+        output_col[ i ].second = best[ i ].m_distance;
+      }
+      return output_col;
+    }
+
+    /**
+    * @brief Performs a range query on the tree.
+    * @param min_point Data containing the minimum values of the query.
+    * @param max_point Data containing the maximum values of the query.
+    * @param output Output iterator that receives every point in range.
+    * @return The output iterator past the last written point.
+    * @details Same as geometricks::kd_tree::range_search, but writes into an output iterator so it can run in a constant expression, for instance into a std::array.
+    */
+    template< typename OutputIterator >
+    constexpr OutputIterator
+    range_search( T min_point, T max_point, OutputIterator output ) const {
+      __organize_data__( min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>() );
+      if constexpr( N > 0 ) {
+        __range_search_impl__<0>( min_point, max_point, __root__(), output );
+      }
+      return output;
+    }
+
+    /**
+    * @brief Returns the number of points stored in the tree.
+    */
+    static constexpr int32_t
+    size() noexcept {
+      return static_cast<int32_t>( N );
+    }
+
+    /**
+    * @brief Accesses the point stored at a given index of the tree.
+    */
+    constexpr const T&
+    operator[]( int32_t index ) const {
+      return m_data_array[ index ];
+    }
+
+  private:
+
+    static constexpr int DATA_DIMENSIONS = dimension::dimensional_traits<T>::dimensions;
+
+    std::array<T, N> m_data_array;
+
+    struct node_t {
+
+      int32_t m_index;
+
+      int32_t m_block_size;
+
+      constexpr operator bool() const {
+        return m_block_size;
+      }
+
+    };
+
+    static constexpr node_t
+    __root__() {
+      return { static_cast<int32_t>( N ) >> 1, static_cast<int32_t>( N ) };
+    }
+
+    static constexpr node_t
+    __left_child__( node_t node ) {
+      int32_t count_left = node.m_block_size >> 1;
+      int32_t index_left = ( node.m_index - ( count_left >> 1 ) - ( count_left & 1 ) );
+      return { index_left, count_left };
+    }
+
+    static constexpr node_t
+    __right_child__( node_t node ) {
+      int32_t count_right = ( node.m_block_size >> 1 ) - !( node.m_block_size & 1 );
+      int32_t index_right = ( node.m_index + ( count_right >> 1 ) + 1 );
+      return { index_right, count_right };
+    }
+
+    //std::pair can't be assigned in a constant expression before C++20.
+    template< typename DistanceType >
+    struct __candidate__ {
+
+      int32_t m_index;
+
+      DistanceType m_distance;
+
+    };
+
+    template< int Dimension >
+    constexpr bool
+    __less__( const T& left, const T& right ) const {
+      return Compare::operator()( dimension::get( left, dimension::dimension_v<Dimension> ), dimension::get( right, dimension::dimension_v<Dimension> ) );
+    }
+
+    template< typename U >
+    static constexpr void
+    __swap__( U& left, U& right ) {
+      U tmp = left;
+      left = right;
+      right = tmp;
+    }
+
+    //Ranges up to this size are sorted instead of partitioned.
+    static constexpr int32_t SMALL_RANGE = 16;
+
+    //std::nth_element isn't constexpr before C++20, so the median is found with a quickselect over [ first, last ). Each step splits the range into the
+    //points smaller than, equal to and greater than a median of 3 pivot, and stops once nth falls among the equal ones, so repeated coordinates, common in
+    //palettes and calibration tables, don't make the selection quadratic. See geometricks::algorithm::three_way_selection.
+    template< int Dimension >
+    constexpr void
+    __select__( std::array<T, N>& data, int32_t first, int32_t last, int32_t nth ) const {
+      while( last - first > SMALL_RANGE ) {
+        T pivot = __median_of_3__<Dimension>( data[ first ], data[ first + ( ( last - first ) >> 1 ) ], data[ last - 1 ] );
+        //[ first, less ) < pivot, [ less, current ) == pivot, [ greater, last ) > pivot.
+        int32_t less = first;
+        int32_t current = first;
+        int32_t greater = last;
+        while( current < greater ) {
+          if( __less__<Dimension>( data[ current ], pivot ) ) {
+            __swap__( data[ less ], data[ current ] );
+            ++less;
+            ++current;
+          }
+          else if( __less__<Dimension>( pivot, data[ current ] ) ) {
+            --greater;
+            __swap__( data[ current ], data[ greater ] );
+          }
+          else {
+            ++current;
+          }
+        }
+        if( nth < less ) {
+          last = less;
+        }
+        else if( greater <= nth ) {
+          first = greater;
+        }
+        else {
+          return;
+        }
+      }
+      for( int32_t i = first + 1; i < last; ++i ) {
+        for( int32_t j = i; j > first && __less__<Dimension>( data[ j ], data[ j - 1 ] ); --j ) {
+          __swap__( data[ j ], data[ j - 1 ] );
+        }
+      }
+    }
+
+    template< int Dimension >
+    constexpr const T&
+    __median_of_3__( const T& a, const T& b, const T& c ) const {
+      if( __less__<Dimension>( a, b ) ) {
+        return __less__<Dimension>( b, c ) ? b : ( __less__<Dimension>( a, c ) ? c : a );
+      }
+      return __less__<Dimension>( a, c ) ? a : ( __less__<Dimension>( b, c ) ? c : b );
+    }
+
+    //scratch[ source, source + blocksize ) holds the points of the subtree that goes to m_data_array[ start, start + blocksize ).
+    template< int Dimension >
+    constexpr void
+    __construct_kd_tree__( std::array<T, N>& scratch, int32_t start, int32_t blocksize, int32_t source ) {
+      if( blocksize > 0 ) {
+        constexpr int NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
+        int32_t step = blocksize >> 1;
+        __select__<Dimension>( scratch, source, source + blocksize, source + step );
+        m_data_array[ start + step ] = scratch[ source + step ];
+        __construct_kd_tree__<NextDimension>( scratch, start, step, source );
+        __construct_kd_tree__<NextDimension>( scratch, start + step + 1, blocksize - step - 1, source + step + 1 );
+      }
+    }
+
+    template< int Dimension, typename DistanceFunction, typename DistanceType >
+    constexpr void
+    __nearest_neighbor_impl__( const T& point, node_t node, int32_t& closest, DistanceType& best_distance, DistanceFunction& f ) const {
+      constexpr int NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
+      const T& current_point = m_data_array[ node.m_index ];
+      bool go_left = __less__<Dimension>( point, current_point );
+      node_t near_child = go_left ? __left_child__( node ) : __right_child__( node );
+      node_t far_child = go_left ? __right_child__( node ) : __left_child__( node );
+      if( near_child ) {
+        __nearest_neighbor_impl__<NextDimension>( point, near_child, closest, best_distance, f );
+      }
+      DistanceType distance = f( point, current_point );
+      if( distance < best_distance ) {
+        best_distance = distance;
+        closest = node.m_index;
+      }
+      if( far_child && __detail__::dimension_distance<Dimension>( f, point, current_point ) < best_distance ) {
+        __nearest_neighbor_impl__<NextDimension>( point, far_child, closest, best_distance, f );
+      }
+    }
+
+    //best is kept sorted by distance, with count valid entries, so the worst of the K candidates is always the last one.
+    template< int Dimension, typename DistanceFunction, size_t K, typename DistanceType >
+    constexpr void
+    __k_nearest_neighbor_impl__( const T& point, node_t node, std::array<__candidate__<DistanceType>, K>& best, size_t& count, DistanceFunction& f ) const {
+      if constexpr( K > 0 ) {
+        constexpr int NextDimension = ( Dimension + 1 ) % DATA_DIMENSIONS;
+        const T& current_point = m_data_array[ node.m_index ];
+        bool go_left = __less__<Dimension>( point, current_point );
+        node_t near_child = go_left ? __left_child__( node ) : __right_child__( node );
+        node_t far_child = go_left ? __right_child__( node ) : __left_child__( node );
+        if( near_child ) {
+          __k_nearest_neighbor_impl__<NextDimension>( point, near_child, best, count, f );
+        }
+        DistanceType distance = f( point, current_point );
+        if( count < K || distance < best[ K - 1 ].m_distance ) {
+          size_t position = count < K ? count++ : K - 1;
+          while( position > 0 && distance < best[ position - 1 ].m_distance ) {
+            best[ position ] = best[ position - 1 ];
+            --position;
+          }
+          best[ position ] = __candidate__<DistanceType>{ node.m_index, distance };
+        }
+        if( far_child && ( count < K || __detail__::dimension_distance<Dimension>( f, point, current_point ) < best[ K - 1 ].m_distance ) ) {
+          __k_nearest_neighbor_impl__<NextDimension>( point, far_child, best, count, f );
+        }
+      }
+    }
+
+    template< size_t... Is >
+    constexpr void
+    __organize_data__( T& first, T& second, std::index_sequence<Is...> ) const {
+      ( __swap_if_greater__( dimension::get( first, dimension::dimension_v<Is> ), dimension::get( second, dimension::dimension_v<Is> ) ), ... );
+    }
+
+    template< typename DataType >
+    constexpr void
+    __swap_if_greater__( DataType& first, DataType& second ) const {
+      if( !Compare::operator()( first, second ) ) {
+        __swap__( first, second );
+      }
+    }
+
+    template< int CurrentDimension, typename OutputIterator >
+    constexpr void
+    __range_search_impl__( const T& min_point, const T& max_point, node_t current_node, OutputIterator& output ) const {
+      const T& current_point = m_data_array[ current_node.m_index ];
+      constexpr int NextDimension = ( CurrentDimension + 1 ) % DATA_DIMENSIONS;
+      bool visit_left = !__less__<CurrentDimension>( current_point, min_point );
+      bool visit_right = !__less__<CurrentDimension>( max_point, current_point );
+      node_t left_child = __left_child__( current_node );
+      if( visit_left && left_child ) {
+        __range_search_impl__<NextDimension>( min_point, max_point, left_child, output );
+      }
+      if( visit_left && visit_right && __is_inside_bounding_box__( current_point, min_point, max_point, std::make_index_sequence<DATA_DIMENSIONS>{} ) ) {
+        *output = current_point;
+        ++output;
+      }
+      node_t right_child = __right_child__( current_node );
+      if( visit_right && right_child ) {
+        __range_search_impl__<NextDimension>( min_point, max_point, right_child, output );
+      }
+    }
+
+    template< size_t... Is >
+    constexpr bool
+    __is_inside_bounding_box__( const T& point, const T& min_point, const T& max_point, std::index_sequence<Is...> ) const {
+      return ( ( !__less__<Is>( point, min_point ) && !__less__<Is>( max_point, point ) ) && ... );
+    }
+
+  };
+
+  template< typename T, size_t N >
+  static_kd_tree( const std::array<T, N>& ) -> static_kd_tree<T, N>;
+
+}
+
+#endif //GEOMETRICKS_DATA_STRUCTURE_STATIC_KD_TREE_HPP
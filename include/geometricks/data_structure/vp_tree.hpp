@@ -0,0 +1,417 @@
+#ifndef GEOMETRICKS_DATA_STRUCTURE_VP_TREE_HPP
+#define GEOMETRICKS_DATA_STRUCTURE_VP_TREE_HPP
+
+//C stdlib includes
+#include <stdint.h>
+
+//C++ stdlib includes
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+//Project includes
+#include "geometricks/meta/utils.hpp"
+#include "geometricks/memory/allocator.hpp"
+
+/**
+* @file Implements a vantage point tree stored as an array, for nearest neighbor queries in arbitrary metric spaces.
+*/
+
+namespace geometricks {
+
+  /**
+  * @brief Cache friendly vantage point tree data structure.
+  * @tparam T The stored data type.
+  * @tparam DistanceFunction Function object that computes the distance between 2 objects of type T. It must be a metric: non negative, symmetric and it must obey the
+  * triangle inequality. Note that geometricks::dimension::euclidean_distance returns the squared euclidean distance, which is not a metric.
+  * @details Unlike geometricks::kd_tree, this tree never looks at the individual dimensions of the data, so it can index anything with a metric, such as strings under
+  * the edit distance or points on a sphere under the geodesic distance. Each node picks a vantage point and splits the remaining elements of its subtree in half by their
+  * distance to it: the inside child holds the elements closer than the node threshold and the outside child holds the rest. Queries prune children using the
+  * triangle inequality.
+  *
+  * Like geometricks::kd_tree, the tree is stored as an array. The vantage point is stored first in the block of its subtree, followed by the inside block and the outside block,
+  * so the thresholds and the elements can be found from the position of the node alone.
+  * @see Yianilos, "Data structures and algorithms for nearest neighbor search in general metric spaces", SODA 1993.
+  */
+  template< typename T,
+            typename DistanceFunction >
+  struct vp_tree {
+
+  private:
+
+    using distance_t = std::decay_t<decltype( std::declval<const DistanceFunction&>()( std::declval<const T&>(), std::declval<const T&>() ) )>;
+
+    static_assert( std::is_arithmetic_v<distance_t>, "The distance function of a vp tree should return an arithmetic type." );
+
+    struct __heap_compare__ {
+      constexpr bool operator()( const std::pair<T*, distance_t>& lhs, const std::pair<T*, distance_t>& rhs ) const noexcept {
+        return lhs.second < rhs.second;
+      }
+    };
+
+  public:
+
+    //Constructor
+
+    /**
+    * @brief Constructs a vp tree with a range of elements
+    * @param begin Iterator to first element of the input range.
+    * @param end Iterator to the last element of the input range or sentinel value.
+    * @param f Distance function object used to build the tree and answer every query.
+    * @param alloc Memory allocator to use. Defaults to the default allocator. See also geometricks::allocator.
+    * @pre If Sentinel is an iterator, first < last. Else, eventually first != last compares false.
+    * @note Complexity: @b O(n log n) distance evaluations.
+    */
+    template< typename InputIterator, typename Sentinel >
+    vp_tree( InputIterator begin, Sentinel end, DistanceFunction f = DistanceFunction{}, geometricks::allocator alloc = geometricks::allocator{} ): m_distance( f ),
+                                                                                                                                               m_allocator( alloc ),
+                                                                                                                                               m_size( std::distance( begin, end ) ),
+                                                                                                                                               m_data_array( ( T* ) m_allocator.allocate( sizeof( T ) * m_size ) ),
+                                                                                                                                               m_threshold_array( ( distance_t* ) m_allocator.allocate( sizeof( distance_t ) * m_size ) ) {
+      std::vector<T> elements( begin, end );
+      std::vector<int32_t> order( m_size );
+      std::iota( order.begin(), order.end(), 0 );
+      std::vector<std::pair<distance_t, int32_t>> scratch( m_size );
+      std::minstd_rand generator;
+      __construct_vp_tree__( elements, order, scratch, 0, m_size, generator );
+      for( int32_t i = 0; i < m_size; ++i ) {
+        new ( &m_data_array[ i ] ) T( elements[ order[ i ] ] );
+      }
+    }
+
+    //Copy constructor
+
+    /**
+    * @brief Copy constructs a vp tree.
+    * @param rhs Right hand side of the copy operation.
+    * @param alloc Memory allocator to use. Defaults to the default allocator. See also geometricks::allocator
+    * @details Performs a deep copy of the right hand side parameter.
+    * @note Complexity: @b O(n)
+    */
+    vp_tree( const vp_tree& rhs, geometricks::allocator alloc = geometricks::allocator{} ): m_distance( rhs.m_distance ),
+                                                                                          m_allocator( alloc ),
+                                                                                          m_size( rhs.m_size ),
+                                                                                          m_data_array( ( T* ) m_allocator.allocate( sizeof( T ) * m_size ) ),
+                                                                                          m_threshold_array( ( distance_t* ) m_allocator.allocate( sizeof( distance_t ) * m_size ) ) {
+      std::uninitialized_copy( rhs.m_data_array, rhs.m_data_array + m_size, m_data_array );
+      std::uninitialized_copy( rhs.m_threshold_array, rhs.m_threshold_array + m_size, m_threshold_array );
+    }
+
+    //Move constructor
+
+    /**
+    * @brief Move constructs a vp tree.
+    * @param rhs Right hand side of the move operation.
+    * @post Invalidates rhs. Any use of rhs after move is an error.
+    * @note Complexity: @b O(1)
+    */
+    vp_tree( vp_tree&& rhs ): m_distance( std::move( rhs.m_distance ) ),
+                              m_allocator( rhs.m_allocator ),
+                              m_size( rhs.m_size ),
+                              m_data_array( rhs.m_data_array ),
+                              m_threshold_array( rhs.m_threshold_array ) {
+      rhs.m_data_array = nullptr;
+      rhs.m_threshold_array = nullptr;
+    }
+
+    //Copy assignment
+
+    /**
+    * @brief Copy assigns a vp tree.
+    * @param rhs Right hand side of the copy operation.
+    * @details Performs a deep copy of the right hand side parameter.
+    * @note Complexity: @b O(n)
+    */
+    vp_tree& operator=( const vp_tree& rhs ) {
+      if( &rhs != this ) {
+        vp_tree copy{ rhs, m_allocator };
+        *this = std::move( copy );
+      }
+      return *this;
+    }
+
+    //Move assignment
+
+    /**
+    * @brief Move assigns a vp tree.
+    * @param rhs Right hand side of the move operation.
+    * @post Invalidates rhs. Any use of rhs after move is an error.
+    * @note Complexity: @b O(1)
+    */
+    vp_tree& operator=( vp_tree&& rhs ) {
+      if( &rhs != this ) {
+        __destroy__();
+        m_distance = std::move( rhs.m_distance );
+        m_allocator = rhs.m_allocator;
+        m_size = rhs.m_size;
+        m_data_array = rhs.m_data_array;
+        m_threshold_array = rhs.m_threshold_array;
+        rhs.m_data_array = nullptr;
+        rhs.m_threshold_array = nullptr;
+      }
+      return *this;
+    }
+
+    ~vp_tree() {
+      __destroy__();
+    }
+
+    /**
+    * @brief Finds the nearest neighbor of an input point.
+    * @param point The input point to query.
+    * @return A pair containing the nearest point and its distance to the input point.
+    * @pre The tree is not empty.
+    */
+    std::pair<const T&, distance_t>
+    nearest_neighbor( const T& point ) const {
+      distance_t best = meta::numeric_limits<distance_t>::max();
+      const T* closest = nullptr;
+      __nearest_neighbor_impl__( point, __root__(), &closest, best );
+      return std::pair<const T&, distance_t>( *closest, best );
+    }
+
+    /**
+    * @brief Finds the k nearest neighbors of an input point.
+    * @param point The input point to query.
+    * @param K the number of desired output points.
+    * @return A vector containing the output points as well as the distance calculated from the input point, in ascending order.
+    */
+    std::vector<std::pair<T, distance_t>>
+    k_nearest_neighbor( const T& point, uint32_t K ) const {
+      std::vector<std::pair<T, distance_t>> output_col;
+      if( K == 0 || m_size == 0 ) {
+        return output_col;
+      }
+      output_col.reserve( K );
+      std::priority_queue<std::pair<T*, distance_t>, std::vector<std::pair<T*, distance_t>>, __heap_compare__> max_heap;
+      __k_nearest_neighbor_impl__( point, __root__(), K, max_heap );
+      while( !max_heap.empty() ) {
+        auto& element = max_heap.top();
+        meta::add_element( std::make_pair( *element.first, element.second ), output_col );
+        max_heap.pop();
+      }
+      std::reverse( output_col.begin(), output_col.end() );
+      return output_col;
+    }
+
+    /**
+    * @brief Finds every point within a given distance of an input point.
+    * @param point The input point to query.
+    * @param radius Maximum distance, inclusive, from the input point.
+    * @return A vector containing the points found as well as their distance to the input point, in no particular order.
+    */
+    std::vector<std::pair<T, distance_t>>
+    radius_search( const T& point, distance_t radius ) const {
+      std::vector<std::pair<T, distance_t>> output_col;
+      if( m_size == 0 ) {
+        return output_col;
+      }
+      __radius_search_impl__( point, __root__(), radius, output_col );
+      return output_col;
+    }
+
+    /**
+    * @brief Returns the number of elements stored in the tree.
+    */
+    int32_t
+    size() const noexcept {
+      return m_size;
+    }
+
+  private:
+
+    DistanceFunction m_distance;
+
+    geometricks::allocator m_allocator;
+
+    int32_t m_size;
+
+    T* m_data_array;
+
+    //Radius that separates the inside child from the outside child of each node. Only meaningful for nodes with children.
+    distance_t* m_threshold_array;
+
+    struct node_t {
+
+      int32_t m_index;
+
+      int32_t m_block_size;
+
+      operator bool() const {
+        return m_block_size;
+      }
+
+    };
+
+    void
+    __destroy__() {
+      if( m_data_array != nullptr ) {
+        for( int32_t i = 0; i < m_size; ++i ) {
+          m_data_array[ i ].~T();
+        }
+        m_allocator.deallocate( m_data_array );
+      }
+      if( m_threshold_array != nullptr ) {
+        m_allocator.deallocate( m_threshold_array );
+      }
+    }
+
+    //Orders order[ start, start + blocksize ) so the vantage point comes first, followed by the inside block and the outside block.
+    void
+    __construct_vp_tree__( const std::vector<T>& elements, std::vector<int32_t>& order, std::vector<std::pair<distance_t, int32_t>>& scratch,
+                           int32_t start, int32_t blocksize, std::minstd_rand& generator ) {
+      if( blocksize == 0 ) {
+        return;
+      }
+      std::swap( order[ start ], order[ start + std::uniform_int_distribution<int32_t>{ 0, blocksize - 1 }( generator ) ] );
+      int32_t inside_count = ( blocksize - 1 ) >> 1;
+      int32_t outside_count = blocksize - 1 - inside_count;
+      m_threshold_array[ start ] = distance_t{};
+      if( blocksize > 1 ) {
+        const T& vantage_point = elements[ order[ start ] ];
+        auto first = scratch.begin() + start + 1;
+        auto last = first + blocksize - 1;
+        for( int32_t i = start + 1; i < start + blocksize; ++i ) {
+          scratch[ i ] = std::make_pair( m_distance( vantage_point, elements[ order[ i ] ] ), order[ i ] );
+        }
+        if( inside_count > 0 ) {
+          std::nth_element( first, first + inside_count - 1, last );
+          m_threshold_array[ start ] = ( first + inside_count - 1 )->first;
+        }
+        else {
+          //A single child only happens with 2 elements, everything goes to the outside block.
+          m_threshold_array[ start ] = first->first;
+        }
+        for( int32_t i = start + 1; i < start + blocksize; ++i ) {
+          order[ i ] = scratch[ i ].second;
+        }
+      }
+      __construct_vp_tree__( elements, order, scratch, start + 1, inside_count, generator );
+      __construct_vp_tree__( elements, order, scratch, start + 1 + inside_count, outside_count, generator );
+    }
+
+    node_t
+    __root__() const {
+      return { 0, m_size };
+    }
+
+    static node_t
+    __inside_child__( node_t node ) {
+      return { node.m_index + 1, ( node.m_block_size - 1 ) >> 1 };
+    }
+
+    static node_t
+    __outside_child__( node_t node ) {
+      int32_t inside_count = ( node.m_block_size - 1 ) >> 1;
+      return { node.m_index + 1 + inside_count, node.m_block_size - 1 - inside_count };
+    }
+
+    //Can an element of the inside child, at most threshold away from the vantage point, be within bound of the query? Written without subtractions
+    //that could go below zero so unsigned distances work.
+    static bool
+    __inside_reachable__( distance_t distance, distance_t threshold, distance_t bound ) {
+      return distance <= threshold || distance - threshold <= bound;
+    }
+
+    //Can an element of the outside child, at least threshold away from the vantage point, be within bound of the query?
+    static bool
+    __outside_reachable__( distance_t distance, distance_t threshold, distance_t bound ) {
+      return distance >= threshold || threshold - distance <= bound;
+    }
+
+    void
+    __nearest_neighbor_impl__( const T& point, node_t node, const T** closest, distance_t& best_distance ) const {
+      const T& vantage_point = m_data_array[ node.m_index ];
+      distance_t distance = m_distance( point, vantage_point );
+      if( distance < best_distance ) {
+        best_distance = distance;
+        *closest = &vantage_point;
+      }
+      distance_t threshold = m_threshold_array[ node.m_index ];
+      node_t inside = __inside_child__( node );
+      node_t outside = __outside_child__( node );
+      //Visit first the side the query falls in, since it is more likely to shrink the bound.
+      if( distance <= threshold ) {
+        if( inside && __inside_reachable__( distance, threshold, best_distance ) ) {
+          __nearest_neighbor_impl__( point, inside, closest, best_distance );
+        }
+        if( outside && __outside_reachable__( distance, threshold, best_distance ) ) {
+          __nearest_neighbor_impl__( point, outside, closest, best_distance );
+        }
+      }
+      else {
+        if( outside && __outside_reachable__( distance, threshold, best_distance ) ) {
+          __nearest_neighbor_impl__( point, outside, closest, best_distance );
+        }
+        if( inside && __inside_reachable__( distance, threshold, best_distance ) ) {
+          __nearest_neighbor_impl__( point, inside, closest, best_distance );
+        }
+      }
+    }
+
+    template< typename MaxHeap >
+    void
+    __k_nearest_neighbor_impl__( const T& point, node_t node, uint32_t K, MaxHeap& max_heap ) const {
+      T& vantage_point = m_data_array[ node.m_index ];
+      distance_t distance = m_distance( point, vantage_point );
+      if( max_heap.size() < K ) {
+        max_heap.emplace( &vantage_point, distance );
+      }
+      else if( distance < max_heap.top().second ) {
+        max_heap.pop();
+        max_heap.emplace( &vantage_point, distance );
+      }
+      auto bound = [ & ]() {
+        return max_heap.size() < K ? meta::numeric_limits<distance_t>::max() : max_heap.top().second;
+      };
+      distance_t threshold = m_threshold_array[ node.m_index ];
+      node_t inside = __inside_child__( node );
+      node_t outside = __outside_child__( node );
+      if( distance <= threshold ) {
+        if( inside && __inside_reachable__( distance, threshold, bound() ) ) {
+          __k_nearest_neighbor_impl__( point, inside, K, max_heap );
+        }
+        if( outside && __outside_reachable__( distance, threshold, bound() ) ) {
+          __k_nearest_neighbor_impl__( point, outside, K, max_heap );
+        }
+      }
+      else {
+        if( outside && __outside_reachable__( distance, threshold, bound() ) ) {
+          __k_nearest_neighbor_impl__( point, outside, K, max_heap );
+        }
+        if( inside && __inside_reachable__( distance, threshold, bound() ) ) {
+          __k_nearest_neighbor_impl__( point, inside, K, max_heap );
+        }
+      }
+    }
+
+    template< typename Collection >
+    void
+    __radius_search_impl__( const T& point, node_t node, distance_t radius, Collection& output_col ) const {
+      if( !node ) {
+        return;
+      }
+      const T& vantage_point = m_data_array[ node.m_index ];
+      distance_t distance = m_distance( point, vantage_point );
+      if( distance <= radius ) {
+        meta::add_element( std::make_pair( vantage_point, distance ), output_col );
+      }
+      distance_t threshold = m_threshold_array[ node.m_index ];
+      if( __inside_reachable__( distance, threshold, radius ) ) {
+        __radius_search_impl__( point, __inside_child__( node ), radius, output_col );
+      }
+      if( __outside_reachable__( distance, threshold, radius ) ) {
+        __radius_search_impl__( point, __outside_child__( node ), radius, output_col );
+      }
+    }
+
+  };
+
+}
+
+#endif //GEOMETRICKS_DATA_STRUCTURE_VP_TREE_HPP
@@ -0,0 +1,32 @@
+#include "gtest/gtest.h"
+#include "geometricks/algorithm/morton_code.hpp"
+#include <array>
+
+TEST( TestMortonCode, TestInterleaving2D ) {
+  EXPECT_EQ( geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 0, 0 } ), 0u );
+  EXPECT_EQ( geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 1, 0 } ), 1u );
+  EXPECT_EQ( geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 0, 1 } ), 2u );
+  EXPECT_EQ( geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 3, 3 } ), 15u );
+  EXPECT_EQ( geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 2, 1 } ), 6u );
+}
+
+TEST( TestMortonCode, TestInterleaving3D ) {
+  EXPECT_EQ( geometricks::algorithm::morton_encode( std::array<uint32_t, 3>{ 1, 1, 1 } ), 7u );
+  EXPECT_EQ( geometricks::algorithm::morton_encode( std::array<uint32_t, 3>{ 0, 0, 2 } ), 32u );
+  EXPECT_EQ( geometricks::algorithm::morton_bits_per_dimension<3>, 21u );
+  uint32_t max_coordinate = ( 1u << 21 ) - 1;
+  EXPECT_EQ( geometricks::algorithm::morton_encode( std::array<uint32_t, 3>{ max_coordinate, max_coordinate, max_coordinate } ), ( uint64_t( 1 ) << 63 ) - 1 );
+}
+
+TEST( TestMortonCode, TestLocality ) {
+  //Points inside the same quadrant share the upper bits of the code.
+  auto first = geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 10, 12 } );
+  auto second = geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 11, 13 } );
+  auto far = geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 1000, 1000 } );
+  EXPECT_EQ( first >> 8, second >> 8 );
+  EXPECT_NE( first >> 8, far >> 8 );
+}
+
+TEST( TestMortonCode, TestConstexpr ) {
+  static_assert( geometricks::algorithm::morton_encode( std::array<uint32_t, 2>{ 3, 0 } ) == 5u );
+}
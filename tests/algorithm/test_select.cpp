@@ -0,0 +1,82 @@
+#include "gtest/gtest.h"
+#include "geometricks/algorithm/select.hpp"
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+
+namespace {
+
+  template< typename Selection >
+  void
+  check_selection( std::vector<int> values, size_t nth ) {
+    auto sorted = values;
+    std::sort( sorted.begin(), sorted.end() );
+    Selection{}( values.begin(), values.begin() + nth, values.end(), std::less<>{} );
+    ASSERT_EQ( values[ nth ], sorted[ nth ] );
+    for( size_t i = 0; i < nth; ++i ) {
+      EXPECT_LE( values[ i ], values[ nth ] );
+    }
+    for( size_t i = nth + 1; i < values.size(); ++i ) {
+      EXPECT_GE( values[ i ], values[ nth ] );
+    }
+    std::sort( values.begin(), values.end() );
+    EXPECT_EQ( values, sorted );
+  }
+
+}
+
+TEST( TestSelect, TestFloydRivestRandom ) {
+  for( int size : { 1, 2, 3, 10, 599, 600, 601, 5000, 100000 } ) {
+    std::vector<int> values( size );
+    for( auto& value : values ) {
+      value = rand() % ( size * 4 );
+    }
+    for( size_t nth : { size_t( 0 ), size_t( size / 3 ), size_t( size / 2 ), size_t( size - 1 ) } ) {
+      check_selection<geometricks::algorithm::floyd_rivest_selection>( values, nth );
+    }
+  }
+}
+
+TEST( TestSelect, TestFloydRivestDuplicatesAndSorted ) {
+  std::vector<int> duplicates( 20000 );
+  for( auto& value : duplicates ) {
+    value = rand() % 3;
+  }
+  check_selection<geometricks::algorithm::floyd_rivest_selection>( duplicates, 10000 );
+  check_selection<geometricks::algorithm::floyd_rivest_selection>( std::vector<int>( 5000, 7 ), 2500 );
+  std::vector<int> sorted( 20000 );
+  for( int i = 0; i < 20000; ++i ) {
+    sorted[ i ] = i;
+  }
+  check_selection<geometricks::algorithm::floyd_rivest_selection>( sorted, 7777 );
+  std::reverse( sorted.begin(), sorted.end() );
+  check_selection<geometricks::algorithm::floyd_rivest_selection>( sorted, 7777 );
+}
+
+TEST( TestSelect, TestNthElement ) {
+  std::vector<int> values( 1000 );
+  for( auto& value : values ) {
+    value = rand() % 100;
+  }
+  check_selection<geometricks::algorithm::nth_element_selection>( values, 500 );
+}
+
+TEST( TestSelect, TestThreeWay ) {
+  for( int size : { 1, 2, 16, 17, 1000, 100000 } ) {
+    for( int cardinality : { 1, 3, 50, size * 4 } ) {
+      std::vector<int> values( size );
+      for( auto& value : values ) {
+        value = rand() % cardinality;
+      }
+      for( size_t nth : { size_t( 0 ), size_t( size / 2 ), size_t( size - 1 ) } ) {
+        check_selection<geometricks::algorithm::three_way_selection>( values, nth );
+      }
+    }
+  }
+  std::vector<int> sorted( 20000 );
+  for( int i = 0; i < 20000; ++i ) {
+    sorted[ i ] = i;
+  }
+  check_selection<geometricks::algorithm::three_way_selection>( sorted, 7777 );
+}
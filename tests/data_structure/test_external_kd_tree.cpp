@@ -0,0 +1,133 @@
+#include "gtest/gtest.h"
+#include "geometricks/data_structure/external_kd_tree.hpp"
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <cstdio>
+
+using namespace geometricks;
+
+namespace {
+
+  using point_t = std::array<int, 3>;
+
+  void
+  write_points( const std::string& path, const std::vector<point_t>& points ) {
+    std::ofstream output( path, std::ios::binary | std::ios::trunc );
+    output.write( reinterpret_cast<const char*>( points.data() ), points.size() * sizeof( point_t ) );
+  }
+
+}
+
+TEST( TestExternalKDTree, TestSameLayoutAsInMemoryBuild ) {
+  //Distinct coordinates in every dimension make the layout unique, so the file has to match the in memory tree exactly.
+  const int count = 60000;
+  std::mt19937 generator{ 3 };
+  std::array<std::vector<int>, 3> coordinates;
+  for( auto& values : coordinates ) {
+    values.resize( count );
+    std::iota( values.begin(), values.end(), 0 );
+    std::shuffle( values.begin(), values.end(), generator );
+  }
+  std::vector<point_t> points( count );
+  for( int i = 0; i < count; ++i ) {
+    points[ i ] = { coordinates[ 0 ][ i ], coordinates[ 1 ][ i ], coordinates[ 2 ][ i ] };
+  }
+  std::string input_path = ::testing::TempDir() + "geometricks_external_input.bin";
+  std::string output_path = ::testing::TempDir() + "geometricks_external_tree.bin";
+  write_points( input_path, points );
+  //The budget holds about 1/20 of the points, so the top levels are split on disk.
+  build_kd_tree_file<point_t>( input_path, output_path, count * sizeof( point_t ) / 20 );
+  kd_tree<point_t> in_memory{ points.begin(), points.end() };
+  {
+    mapped_kd_tree<point_t> mapped{ output_path };
+    ASSERT_EQ( mapped->size(), count );
+    for( int i = 0; i < count; ++i ) {
+      ASSERT_EQ( mapped->operator[]( i ), in_memory[ i ] );
+    }
+    point_t query{ 100, 20000, 45000 };
+    EXPECT_EQ( mapped->nearest_neighbor( query ).second, in_memory.nearest_neighbor( query ).second );
+  }
+  std::remove( input_path.c_str() );
+  std::remove( output_path.c_str() );
+}
+
+TEST( TestExternalKDTree, TestDuplicateHeavyInput ) {
+  std::vector<point_t> points;
+  for( int i = 0; i < 40000; ++i ) {
+    points.push_back( { rand() % 4, rand() % 3, i % 7 == 0 ? rand() % 1000 : 5 } );
+  }
+  std::string input_path = ::testing::TempDir() + "geometricks_external_duplicates.bin";
+  std::string output_path = ::testing::TempDir() + "geometricks_external_duplicates_tree.bin";
+  write_points( input_path, points );
+  build_kd_tree_file<point_t>( input_path, output_path, 16 * 1024 );
+  {
+    mapped_kd_tree<point_t> mapped{ output_path };
+    ASSERT_EQ( mapped->size(), static_cast<int32_t>( points.size() ) );
+    std::vector<point_t> stored;
+    for( int32_t i = 0; i < mapped->size(); ++i ) {
+      stored.push_back( mapped->operator[]( i ) );
+    }
+    std::vector<point_t> expected = points;
+    std::sort( stored.begin(), stored.end() );
+    std::sort( expected.begin(), expected.end() );
+    EXPECT_EQ( stored, expected );
+    for( int i = 0; i < 50; ++i ) {
+      point_t min_point{ rand() % 4, rand() % 3, rand() % 1000 };
+      point_t max_point{ rand() % 4, rand() % 3, rand() % 1000 };
+      size_t brute_force = 0;
+      for( auto& point : points ) {
+        bool inside = true;
+        for( size_t j = 0; j < 3; ++j ) {
+          inside = inside && point[ j ] >= std::min( min_point[ j ], max_point[ j ] ) && point[ j ] <= std::max( min_point[ j ], max_point[ j ] );
+        }
+        brute_force += inside;
+      }
+      EXPECT_EQ( mapped->range_search( min_point, max_point ).size(), brute_force );
+      point_t query{ rand() % 4, rand() % 3, rand() % 1000 };
+      size_t best = meta::numeric_limits<size_t>::max();
+      for( auto& point : points ) {
+        best = std::min( best, dimension::euclidean_distance{}( point, query ) );
+      }
+      EXPECT_EQ( mapped->nearest_neighbor( query ).second, best );
+    }
+  }
+  std::remove( input_path.c_str() );
+  std::remove( output_path.c_str() );
+}
+
+TEST( TestExternalKDTree, TestCopyOutlivesMapping ) {
+  std::mt19937 generator{ 7 };
+  std::uniform_int_distribution<int> coordinate( 0, 999 );
+  std::vector<point_t> points( 5000 );
+  for( auto& point : points ) {
+    point = { coordinate( generator ), coordinate( generator ), coordinate( generator ) };
+  }
+  std::string input_path = ::testing::TempDir() + "geometricks_external_copy.bin";
+  std::string output_path = ::testing::TempDir() + "geometricks_external_copy_tree.bin";
+  write_points( input_path, points );
+  build_kd_tree_file<point_t>( input_path, output_path, 1 << 20 );
+  std::unique_ptr<kd_tree<point_t>> copy;
+  kd_tree<point_t> assigned{ points.begin(), points.begin() + 10 };
+  {
+    mapped_kd_tree<point_t> mapped{ output_path };
+    copy = std::make_unique<kd_tree<point_t>>( mapped.tree() );
+    assigned = mapped.tree();
+    EXPECT_NE( &( *copy )[ 0 ], &mapped->operator[]( 0 ) );
+  }
+  //The copies own their points, so they are still valid once the file is unmapped.
+  std::remove( output_path.c_str() );
+  kd_tree<point_t> in_memory{ points.begin(), points.end() };
+  ASSERT_EQ( copy->size(), 5000 );
+  ASSERT_EQ( assigned.size(), 5000 );
+  for( int i = 0; i < 50; ++i ) {
+    point_t query{ coordinate( generator ), coordinate( generator ), coordinate( generator ) };
+    EXPECT_EQ( copy->nearest_neighbor( query ).second, in_memory.nearest_neighbor( query ).second );
+    EXPECT_EQ( assigned.nearest_neighbor( query ).second, in_memory.nearest_neighbor( query ).second );
+  }
+  std::remove( input_path.c_str() );
+}
@@ -0,0 +1,92 @@
+#include "gtest/gtest.h"
+#include "geometricks/data_structure/kd_forest.hpp"
+#include <vector>
+#include <array>
+#include <algorithm>
+
+using namespace geometricks;
+
+namespace {
+
+  using point_t = std::array<int, 16>;
+
+  std::vector<point_t>
+  make_points( int count ) {
+    std::vector<point_t> points( count );
+    for( auto& point : points ) {
+      for( auto& coordinate : point ) {
+        coordinate = rand() % 1000;
+      }
+    }
+    return points;
+  }
+
+  std::vector<size_t>
+  brute_force_distances( const std::vector<point_t>& points, const point_t& query, size_t K ) {
+    std::vector<size_t> distances;
+    for( auto& point : points ) {
+      distances.push_back( dimension::euclidean_distance{}( point, query ) );
+    }
+    std::sort( distances.begin(), distances.end() );
+    distances.resize( std::min( K, distances.size() ) );
+    return distances;
+  }
+
+}
+
+TEST( TestKDForest, TestExactWithUnboundedChecks ) {
+  auto points = make_points( 3000 );
+  kd_forest<point_t> forest{ points.begin(), points.end(), 4, 42 };
+  EXPECT_EQ( forest.size(), 3000 );
+  EXPECT_EQ( forest.tree_count(), 4 );
+  for( int i = 0; i < 50; ++i ) {
+    auto query = make_points( 1 )[ 0 ];
+    auto expected = brute_force_distances( points, query, 10 );
+    auto result = forest.k_nearest_neighbor( query, 10, forest.size() * forest.tree_count() );
+    ASSERT_EQ( result.size(), expected.size() );
+    for( size_t j = 0; j < result.size(); ++j ) {
+      EXPECT_EQ( result[ j ].second, expected[ j ] );
+      EXPECT_EQ( dimension::euclidean_distance{}( result[ j ].first, query ), result[ j ].second );
+    }
+    auto [ nearest, distance ] = forest.nearest_neighbor( query, forest.size() * forest.tree_count() );
+    EXPECT_EQ( distance, expected[ 0 ] );
+    EXPECT_EQ( dimension::euclidean_distance{}( nearest, query ), distance );
+  }
+}
+
+TEST( TestKDForest, TestBoundedChecksRecall ) {
+  auto points = make_points( 20000 );
+  kd_forest<point_t> forest{ points.begin(), points.end(), 8, 7 };
+  int found = 0;
+  int total = 0;
+  for( int i = 0; i < 50; ++i ) {
+    auto query = make_points( 1 )[ 0 ];
+    auto expected = brute_force_distances( points, query, 5 );
+    auto result = forest.k_nearest_neighbor( query, 5, 2000 );
+    ASSERT_EQ( result.size(), 5u );
+    for( size_t j = 0; j < result.size(); ++j ) {
+      //Approximate results can never be better than the exact ones.
+      EXPECT_GE( result[ j ].second, expected[ j ] );
+      if( j > 0 ) {
+        EXPECT_LE( result[ j - 1 ].second, result[ j ].second );
+      }
+      found += std::find( expected.begin(), expected.end(), result[ j ].second ) != expected.end();
+      ++total;
+    }
+  }
+  EXPECT_GT( found * 2, total );
+}
+
+TEST( TestKDForest, TestNoDuplicateResults ) {
+  std::vector<point_t> points = make_points( 200 );
+  kd_forest<point_t> forest{ points.begin(), points.end(), 6, 1 };
+  auto result = forest.k_nearest_neighbor( points[ 0 ], 200, 100000 );
+  ASSERT_EQ( result.size(), 200u );
+  std::vector<point_t> returned;
+  for( auto& [ point, distance ] : result ) {
+    returned.push_back( point );
+  }
+  std::sort( returned.begin(), returned.end() );
+  std::sort( points.begin(), points.end() );
+  EXPECT_EQ( returned, points );
+}
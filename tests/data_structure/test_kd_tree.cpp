@@ -3,6 +3,8 @@
 #include <vector>
 #include <tuple>
 #include <array>
+#include <cstdlib>
+#include <thread>
 
 using namespace geometricks;
 
@@ -413,3 +415,656 @@ TEST( TestKDTree, TestNearestNeighborCustomFunction ) {
   EXPECT_EQ( custom_nearest_neghbor_function::calls_tuple_int_dim2, 1 );
   ( void )distance;
 }
+
+TEST( TestKDTree, TestQueryStatistics ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  {
+    kd_tree_statistics stats;
+    auto [nearest, distance] = tree.nearest_neighbor( std::make_tuple( 5000, 5000, 5000 ), dimension::euclidean_distance{}, stats );
+    auto [expected_nearest, expected_distance] = tree.nearest_neighbor( std::make_tuple( 5000, 5000, 5000 ) );
+    EXPECT_EQ( nearest, expected_nearest );
+    EXPECT_EQ( distance, expected_distance );
+    EXPECT_GT( stats.nodes_visited, 0 );
+    EXPECT_LT( stats.nodes_visited, 20000 );
+    EXPECT_EQ( stats.distance_evaluations, stats.nodes_visited );
+    EXPECT_GT( stats.subtrees_pruned, 0 );
+    EXPECT_GE( stats.max_depth, 15 );
+    EXPECT_EQ( stats.result_count, 1 );
+  }
+  {
+    kd_tree_statistics stats;
+    auto output_vector = tree.k_nearest_neighbor( std::make_tuple( 5000, 5000, 5000 ), 10, dimension::euclidean_distance{}, stats );
+    EXPECT_EQ( output_vector.size(), 10u );
+    EXPECT_EQ( stats.result_count, 10 );
+    EXPECT_GT( stats.subtrees_pruned, 0 );
+  }
+  {
+    kd_tree_statistics stats;
+    auto output_vector = tree.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 1000, 1000, 1000 ), stats );
+    EXPECT_EQ( stats.result_count, static_cast<int64_t>( output_vector.size() ) );
+    EXPECT_GT( stats.subtrees_pruned, 0 );
+    EXPECT_EQ( stats.distance_evaluations, 0 );
+  }
+  {
+    kd_tree_shared_statistics shared_stats;
+    for( int i = 0; i < 4; ++i ) {
+      kd_tree_statistics stats;
+      tree.nearest_neighbor( std::make_tuple( i * 1000, i * 1000, i * 1000 ), dimension::euclidean_distance{}, stats );
+      shared_stats += stats;
+    }
+    tree.nearest_neighbor( std::make_tuple( 10, 10, 10 ), dimension::euclidean_distance{}, shared_stats );
+    EXPECT_EQ( shared_stats.snapshot().result_count, 5 );
+    EXPECT_GT( shared_stats.snapshot().nodes_visited, 5 );
+  }
+}
+
+TEST( TestKDTree, TestFilteredNearestNeighbor ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  auto is_even = []( const std::tuple<int, int, int>& point ) {
+    return std::get<0>( point ) % 2 == 0;
+  };
+  for( int i = 0; i < 20; ++i ) {
+    auto query = std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 );
+    std::vector<std::pair<std::tuple<int, int, int>, size_t>> expected;
+    for( auto& element : input_vector ) {
+      if( is_even( element ) ) {
+        expected.push_back( std::make_pair( element, dimension::euclidean_distance{}( query, element ) ) );
+      }
+    }
+    std::sort( expected.begin(), expected.end(), []( const auto& lhs, const auto& rhs ) { return lhs.second < rhs.second; } );
+    auto [nearest, distance] = tree.nearest_neighbor_if( query, is_even );
+    ASSERT_NE( nearest, nullptr );
+    EXPECT_TRUE( is_even( *nearest ) );
+    EXPECT_EQ( distance, expected[ 0 ].second );
+    auto output_vector = tree.k_nearest_neighbor_if( query, 8, is_even );
+    ASSERT_EQ( output_vector.size(), 8u );
+    for( size_t j = 0; j < output_vector.size(); ++j ) {
+      EXPECT_TRUE( is_even( output_vector[ j ].first ) );
+      EXPECT_EQ( output_vector[ j ].second, expected[ j ].second );
+    }
+  }
+  auto reject_all = []( const std::tuple<int, int, int>& ) { return false; };
+  auto [nearest, distance] = tree.nearest_neighbor_if( std::make_tuple( 10, 10, 10 ), reject_all );
+  EXPECT_EQ( nearest, nullptr );
+  ( void ) distance;
+  EXPECT_TRUE( tree.k_nearest_neighbor_if( std::make_tuple( 10, 10, 10 ), 5, reject_all ).empty() );
+}
+
+TEST( TestKDTree, TestKNearestNeighborPointers ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 5000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  EXPECT_EQ( tree.size(), 5000 );
+  for( int i = 0; i < 10; ++i ) {
+    auto query = std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 );
+    auto copies = tree.k_nearest_neighbor( query, 7 );
+    auto pointers = tree.k_nearest_neighbor_ptr( query, 7 );
+    ASSERT_EQ( copies.size(), pointers.size() );
+    for( size_t j = 0; j < copies.size(); ++j ) {
+      EXPECT_EQ( copies[ j ].second, pointers[ j ].second );
+      EXPECT_EQ( dimension::euclidean_distance{}( query, *pointers[ j ].first ), pointers[ j ].second );
+      int32_t index = tree.index_of( *pointers[ j ].first );
+      EXPECT_EQ( &tree[ index ], pointers[ j ].first );
+    }
+  }
+}
+
+TEST( TestKDTree, TestBatchQueries ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  std::vector<std::tuple<int, int, int>> queries;
+  for( int i = 0; i < 500; ++i ) {
+    queries.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  auto nearest_output = tree.batch_nearest_neighbor( queries.begin(), queries.end() );
+  auto k_nearest_output = tree.batch_k_nearest_neighbor( queries.begin(), queries.end(), 4 );
+  ASSERT_EQ( nearest_output.size(), queries.size() );
+  ASSERT_EQ( k_nearest_output.size(), queries.size() );
+  for( size_t i = 0; i < queries.size(); ++i ) {
+    auto [nearest, distance] = tree.nearest_neighbor( queries[ i ] );
+    EXPECT_EQ( nearest_output[ i ].first, &nearest );
+    EXPECT_EQ( nearest_output[ i ].second, distance );
+    EXPECT_EQ( k_nearest_output[ i ], tree.k_nearest_neighbor( queries[ i ], 4 ) );
+  }
+  std::vector<std::tuple<int, int, int>> empty_queries;
+  EXPECT_TRUE( tree.batch_nearest_neighbor( empty_queries.begin(), empty_queries.end() ).empty() );
+}
+
+struct prefetching_traits : kd_tree_traits {
+  static constexpr int prefetch_depth = 2;
+};
+
+TEST( TestKDTree, TestPrefetchingTraits ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  kd_tree<std::tuple<int, int, int>, std::less<>, prefetching_traits> prefetching_tree{ input_vector.begin(), input_vector.end() };
+  for( int i = 0; i < 100; ++i ) {
+    auto query = std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 );
+    EXPECT_EQ( tree.nearest_neighbor( query ), prefetching_tree.nearest_neighbor( query ) );
+    EXPECT_EQ( tree.k_nearest_neighbor( query, 5 ), prefetching_tree.k_nearest_neighbor( query, 5 ) );
+  }
+  auto output_vector = tree.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 2000, 2000, 2000 ) );
+  auto prefetching_output_vector = prefetching_tree.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 2000, 2000, 2000 ) );
+  std::sort( output_vector.begin(), output_vector.end() );
+  std::sort( prefetching_output_vector.begin(), prefetching_output_vector.end() );
+  EXPECT_EQ( output_vector, prefetching_output_vector );
+}
+
+TEST( TestKDTree, TestParallelRangeSearch ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 100000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  for( uint32_t thread_count : { 1u, 2u, 4u, 7u } ) {
+    auto output_vector = tree.range_search( std::make_tuple( 1000, 0, 2000 ), std::make_tuple( 9000, 6000, 8000 ) );
+    auto parallel_output_vector = tree.parallel_range_search( std::make_tuple( 9000, 0, 8000 ), std::make_tuple( 1000, 6000, 2000 ), thread_count );
+    std::sort( output_vector.begin(), output_vector.end() );
+    std::sort( parallel_output_vector.begin(), parallel_output_vector.end() );
+    EXPECT_EQ( output_vector, parallel_output_vector );
+  }
+  EXPECT_TRUE( tree.parallel_range_search( std::make_tuple( -10, -10, -10 ), std::make_tuple( -1, -1, -1 ) ).empty() );
+}
+
+namespace {
+
+  struct count_and_sum_monoid {
+    using value_type = std::pair<int64_t, int64_t>;
+    value_type identity() const { return { 0, 0 }; }
+    value_type lift( const std::tuple<int, int, int>& point ) const { return { 1, std::get<2>( point ) }; }
+    value_type combine( const value_type& lhs, const value_type& rhs ) const { return { lhs.first + rhs.first, lhs.second + rhs.second }; }
+  };
+
+  struct aggregate_traits : kd_tree_traits {
+    using aggregate_monoid = count_and_sum_monoid;
+  };
+
+}
+
+TEST( TestKDTree, TestRangeAggregate ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 100, rand() % 1000, rand() % 1000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>, std::less<>, aggregate_traits> tree{ input_vector.begin(), input_vector.end() };
+  for( int i = 0; i < 200; ++i ) {
+    auto min_point = std::make_tuple( rand() % 100, rand() % 1000, rand() % 1000 );
+    auto max_point = std::make_tuple( rand() % 100, rand() % 1000, rand() % 1000 );
+    int64_t count = 0;
+    int64_t sum = 0;
+    for( auto& point : tree.range_search( min_point, max_point ) ) {
+      ++count;
+      sum += std::get<2>( point );
+    }
+    auto [ aggregate_count, aggregate_sum ] = tree.range_aggregate( min_point, max_point );
+    EXPECT_EQ( aggregate_count, count );
+    EXPECT_EQ( aggregate_sum, sum );
+  }
+  //The bounding box of the points bounds the cells on the border of the data, so a query covering everything is answered at the root.
+  kd_tree_statistics everything_stats;
+  auto everything = tree.range_aggregate( std::make_tuple( 0, 0, 0 ), std::make_tuple( 100, 1000, 1000 ), everything_stats );
+  EXPECT_EQ( everything.first, 20000 );
+  EXPECT_EQ( everything_stats.nodes_visited, 1 );
+  //A query covering a whole side of the data only walks the cells crossed by its other side.
+  kd_tree_statistics half_stats;
+  kd_tree_statistics search_stats;
+  auto half = tree.range_aggregate( std::make_tuple( 0, 0, 0 ), std::make_tuple( 49, 1000, 1000 ), half_stats );
+  EXPECT_EQ( half.first, static_cast<int64_t>( tree.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 49, 1000, 1000 ), search_stats ).size() ) );
+  EXPECT_LT( half_stats.nodes_visited * 5, search_stats.nodes_visited );
+  kd_tree<std::tuple<int, int, int>, std::less<>, aggregate_traits> copy{ tree };
+  EXPECT_EQ( copy.range_aggregate( std::make_tuple( 0, 0, 0 ), std::make_tuple( 50, 500, 500 ) ), tree.range_aggregate( std::make_tuple( 0, 0, 0 ), std::make_tuple( 50, 500, 500 ) ) );
+  std::vector<std::tuple<int, int, int>> empty;
+  kd_tree<std::tuple<int, int, int>, std::less<>, aggregate_traits> empty_tree{ empty.begin(), empty.end() };
+  EXPECT_EQ( empty_tree.range_aggregate( std::make_tuple( 0, 0, 0 ), std::make_tuple( 1, 1, 1 ) ).first, 0 );
+}
+
+TEST( TestKDTree, TestPartialRangeSearch ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  auto sorted = []( std::vector<std::tuple<int, int, int>> points ) {
+    std::sort( points.begin(), points.end() );
+    return points;
+  };
+  for( int i = 0; i < 50; ++i ) {
+    auto min_point = std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 );
+    auto max_point = std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 );
+    //Only dimensions 0 and 2 are constrained, so dimension 1 spans everything.
+    auto full_min = std::make_tuple( std::get<0>( min_point ), std::numeric_limits<int>::lowest(), std::get<2>( min_point ) );
+    auto full_max = std::make_tuple( std::get<0>( max_point ), std::numeric_limits<int>::max(), std::get<2>( max_point ) );
+    if( std::get<0>( full_min ) > std::get<0>( full_max ) ) {
+      std::swap( std::get<0>( full_min ), std::get<0>( full_max ) );
+    }
+    if( std::get<2>( full_min ) > std::get<2>( full_max ) ) {
+      std::swap( std::get<2>( full_min ), std::get<2>( full_max ) );
+    }
+    auto expected = sorted( tree.range_search( full_min, full_max ) );
+    EXPECT_EQ( sorted( tree.partial_range_search<0, 2>( min_point, max_point ) ), expected );
+    EXPECT_EQ( sorted( tree.partial_range_search( min_point, max_point, std::bitset<3>{ "101" } ) ), expected );
+  }
+  EXPECT_EQ( tree.partial_range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 0, 0, 0 ), std::bitset<3>{} ).size(), input_vector.size() );
+}
+
+TEST( TestKDTree, TestBoundedKNearestNeighbor ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  for( int i = 0; i < 100; ++i ) {
+    auto query = std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 );
+    size_t max_distance = rand() % 1000000;
+    auto unbounded = tree.k_nearest_neighbor( query, 10 );
+    std::vector<std::pair<std::tuple<int, int, int>, size_t>> expected;
+    for( auto& element : unbounded ) {
+      if( element.second <= max_distance ) {
+        expected.push_back( element );
+      }
+    }
+    auto bounded = tree.k_nearest_neighbor( query, 10, max_distance );
+    ASSERT_EQ( bounded.size(), expected.size() );
+    for( size_t j = 0; j < bounded.size(); ++j ) {
+      EXPECT_EQ( bounded[ j ].second, expected[ j ].second );
+    }
+  }
+  //A tiny cutoff around an empty area returns nothing and a huge one behaves like the unbounded search.
+  EXPECT_TRUE( tree.k_nearest_neighbor( std::make_tuple( -100000, -100000, -100000 ), 5, 10 ).empty() );
+  EXPECT_EQ( tree.k_nearest_neighbor( std::make_tuple( 5, 5, 5 ), 5, meta::numeric_limits<size_t>::max(), dimension::euclidean_distance{} ).size(), 5u );
+}
+
+TEST( TestKDTree, TestWeightedEuclideanDistance ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  dimension::weighted_euclidean_distance distance{ std::array<double, 3>{ 4.0, 0.25, 1.5 } };
+  EXPECT_DOUBLE_EQ( distance( std::make_tuple( 1, 2, 3 ), std::make_tuple( 2, 4, 5 ) ), 4.0 + 0.25 * 4 + 1.5 * 4 );
+  for( int i = 0; i < 100; ++i ) {
+    auto query = std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 );
+    std::vector<double> distances;
+    for( auto& element : input_vector ) {
+      distances.push_back( distance( element, query ) );
+    }
+    std::sort( distances.begin(), distances.end() );
+    EXPECT_DOUBLE_EQ( tree.nearest_neighbor( query, distance ).second, distances[ 0 ] );
+    auto k_nearest = tree.k_nearest_neighbor( query, 5, distance );
+    for( size_t j = 0; j < k_nearest.size(); ++j ) {
+      EXPECT_DOUBLE_EQ( k_nearest[ j ].second, distances[ j ] );
+    }
+  }
+}
+
+namespace {
+
+  struct counting_allocator {
+    int allocations = 0;
+    int live = 0;
+    void* allocate( size_t size ) {
+      ++allocations;
+      ++live;
+      return std::malloc( size );
+    }
+    void deallocate( void* ptr ) {
+      --live;
+      std::free( ptr );
+    }
+  };
+
+}
+
+TEST( TestKDTree, TestRebuild ) {
+  counting_allocator counter;
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 5000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end(), geometricks::default_compare, geometricks::allocator{ counter } };
+  //The points and the block that shares them between copies.
+  EXPECT_EQ( counter.allocations, 2 );
+  EXPECT_EQ( tree.capacity(), 5000 );
+  const std::tuple<int, int, int>* storage = &tree[ 0 ];
+  for( int frame = 0; frame < 5; ++frame ) {
+    for( auto& point : input_vector ) {
+      point = std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 );
+    }
+    if( frame == 4 ) {
+      input_vector.resize( 3000 );
+    }
+    tree.rebuild( input_vector.begin(), input_vector.end() );
+    EXPECT_EQ( counter.allocations, 2 );
+    EXPECT_EQ( &tree[ 0 ], storage );
+    EXPECT_EQ( tree.size(), static_cast<int32_t>( input_vector.size() ) );
+    kd_tree<std::tuple<int, int, int>> fresh{ input_vector.begin(), input_vector.end() };
+    for( int i = 0; i < 50; ++i ) {
+      auto query = std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 );
+      EXPECT_EQ( tree.nearest_neighbor( query ).second, fresh.nearest_neighbor( query ).second );
+    }
+  }
+  input_vector.resize( 6000, std::make_tuple( 1, 2, 3 ) );
+  tree.rebuild( input_vector.begin(), input_vector.end() );
+  EXPECT_EQ( counter.allocations, 4 );
+  EXPECT_EQ( counter.live, 2 );
+  EXPECT_EQ( tree.capacity(), 6000 );
+  EXPECT_EQ( tree.nearest_neighbor( std::make_tuple( 1, 2, 3 ) ).second, 0u );
+  kd_tree<std::tuple<int, int, int>> smaller{ input_vector.begin(), input_vector.begin() + 100 };
+  tree = smaller;
+  EXPECT_EQ( counter.allocations, 4 );
+  EXPECT_EQ( counter.live, 0 );
+  EXPECT_EQ( tree.size(), 100 );
+  EXPECT_EQ( tree.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 1000, 1000, 1000 ) ).size(), 100u );
+  kd_tree<std::tuple<int, int, int>, std::less<>, aggregate_traits> aggregate_tree{ input_vector.begin(), input_vector.end() };
+  input_vector.resize( 4000 );
+  aggregate_tree.rebuild( input_vector.begin(), input_vector.end() );
+  EXPECT_EQ( aggregate_tree.range_aggregate( std::make_tuple( 0, 0, 0 ), std::make_tuple( 1000, 1000, 1000 ) ).first, 4000 );
+}
+
+TEST( TestKDTree, TestNearestNeighborHint ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  auto position = std::make_tuple( 5000, 5000, 5000 );
+  nearest_neighbor_hint hint{ -1 };
+  kd_tree_statistics hinted_stats;
+  kd_tree_statistics cold_stats;
+  for( int tick = 0; tick < 200; ++tick ) {
+    std::get<0>( position ) += rand() % 21 - 10;
+    std::get<1>( position ) += rand() % 21 - 10;
+    std::get<2>( position ) += rand() % 21 - 10;
+    auto [ nearest, distance ] = tree.nearest_neighbor( position, hint, dimension::euclidean_distance{}, hinted_stats );
+    auto [ expected, expected_distance ] = tree.nearest_neighbor( position, dimension::euclidean_distance{}, cold_stats );
+    EXPECT_EQ( distance, expected_distance );
+    EXPECT_EQ( nearest, expected );
+    hint.index = tree.index_of( nearest );
+  }
+  EXPECT_LE( hinted_stats.nodes_visited, cold_stats.nodes_visited );
+  //A far away hint and an invalid hint don't change the result.
+  auto query = std::make_tuple( 10, 10, 10 );
+  auto far_hint = nearest_neighbor_hint{ tree.index_of( tree.nearest_neighbor( std::make_tuple( 9999, 9999, 9999 ) ).first ) };
+  EXPECT_EQ( tree.nearest_neighbor( query, far_hint ).second, tree.nearest_neighbor( query ).second );
+  EXPECT_EQ( tree.nearest_neighbor( query, nearest_neighbor_hint{ 1 << 30 } ).second, tree.nearest_neighbor( query ).second );
+}
+
+struct floyd_rivest_traits : kd_tree_traits {
+  using split_selection = algorithm::floyd_rivest_selection;
+};
+
+TEST( TestKDTree, TestFloydRivestSplitSelection ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 50000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 100, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  kd_tree<std::tuple<int, int, int>, std::less<>, floyd_rivest_traits> floyd_rivest_tree{ input_vector.begin(), input_vector.end() };
+  for( int i = 0; i < 100; ++i ) {
+    auto query = std::make_tuple( rand() % 10000, rand() % 100, rand() % 10000 );
+    EXPECT_EQ( tree.nearest_neighbor( query ).second, floyd_rivest_tree.nearest_neighbor( query ).second );
+    auto expected = tree.k_nearest_neighbor( query, 8 );
+    auto output = floyd_rivest_tree.k_nearest_neighbor( query, 8 );
+    for( size_t j = 0; j < expected.size(); ++j ) {
+      EXPECT_EQ( expected[ j ].second, output[ j ].second );
+    }
+  }
+  auto output_vector = tree.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 2000, 50, 2000 ) );
+  auto floyd_rivest_output_vector = floyd_rivest_tree.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 2000, 50, 2000 ) );
+  std::sort( output_vector.begin(), output_vector.end() );
+  std::sort( floyd_rivest_output_vector.begin(), floyd_rivest_output_vector.end() );
+  EXPECT_EQ( output_vector, floyd_rivest_output_vector );
+}
+
+struct three_way_traits : kd_tree_traits {
+  using split_selection = algorithm::three_way_selection;
+};
+
+TEST( TestKDTree, TestThreeWaySplitSelection ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 50000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 2, rand() % 4, rand() % 10000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  kd_tree<std::tuple<int, int, int>, std::less<>, three_way_traits> three_way_tree{ input_vector.begin(), input_vector.end() };
+  for( int i = 0; i < 100; ++i ) {
+    auto query = std::make_tuple( rand() % 2, rand() % 4, rand() % 10000 );
+    EXPECT_EQ( tree.nearest_neighbor( query ).second, three_way_tree.nearest_neighbor( query ).second );
+    auto expected = tree.k_nearest_neighbor( query, 8 );
+    auto output = three_way_tree.k_nearest_neighbor( query, 8 );
+    for( size_t j = 0; j < expected.size(); ++j ) {
+      EXPECT_EQ( expected[ j ].second, output[ j ].second );
+    }
+  }
+  auto output_vector = tree.range_search( std::make_tuple( 1, 1, 0 ), std::make_tuple( 1, 2, 5000 ) );
+  auto three_way_output_vector = three_way_tree.range_search( std::make_tuple( 1, 1, 0 ), std::make_tuple( 1, 2, 5000 ) );
+  std::sort( output_vector.begin(), output_vector.end() );
+  std::sort( three_way_output_vector.begin(), three_way_output_vector.end() );
+  EXPECT_EQ( output_vector, three_way_output_vector );
+}
+
+struct lazy_traits : kd_tree_traits {
+  static constexpr int32_t lazy_subtree_size = 100;
+};
+
+TEST( TestKDTree, TestLazyConstruction ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 50000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 ) );
+  }
+  auto lazy_input = input_vector;
+  auto original_input = input_vector;
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  kd_tree<std::tuple<int, int, int>, std::less<>, lazy_traits> lazy_tree{ lazy_input.begin(), lazy_input.end() };
+  //The input is only copied, not reordered.
+  EXPECT_EQ( lazy_input, original_input );
+  auto sorted_range = []( std::vector<std::tuple<int, int, int>> points ) {
+    std::sort( points.begin(), points.end() );
+    return points;
+  };
+  //Concurrent queries race to build the same subtrees.
+  std::vector<std::thread> threads;
+  std::atomic<int> mismatches{ 0 };
+  for( int t = 0; t < 4; ++t ) {
+    threads.emplace_back( [ &, t ]() {
+      for( int i = 0; i < 50; ++i ) {
+        auto query = std::make_tuple( ( i * 7919 + t * 104729 ) % 10000, ( i * 6271 + t * 3571 ) % 10000, ( i * 3181 + t * 1297 ) % 10000 );
+        if( tree.nearest_neighbor( query ).second != lazy_tree.nearest_neighbor( query ).second ) {
+          ++mismatches;
+        }
+      }
+    } );
+  }
+  for( auto& thread : threads ) {
+    thread.join();
+  }
+  EXPECT_EQ( mismatches, 0 );
+  for( int i = 0; i < 100; ++i ) {
+    auto query = std::make_tuple( rand() % 10000, rand() % 10000, rand() % 10000 );
+    EXPECT_EQ( tree.nearest_neighbor( query ).second, lazy_tree.nearest_neighbor( query ).second );
+    auto expected = tree.k_nearest_neighbor( query, 8 );
+    auto output = lazy_tree.k_nearest_neighbor( query, 8 );
+    ASSERT_EQ( expected.size(), output.size() );
+    for( size_t j = 0; j < expected.size(); ++j ) {
+      EXPECT_EQ( expected[ j ].second, output[ j ].second );
+    }
+  }
+  auto min_point = std::make_tuple( 1000, 2000, 3000 );
+  auto max_point = std::make_tuple( 4000, 5000, 6000 );
+  EXPECT_EQ( sorted_range( lazy_tree.range_search( min_point, max_point ) ), sorted_range( tree.range_search( min_point, max_point ) ) );
+  EXPECT_EQ( sorted_range( lazy_tree.parallel_range_search( min_point, max_point, 4 ) ), sorted_range( tree.range_search( min_point, max_point ) ) );
+  EXPECT_EQ( sorted_range( lazy_tree.partial_range_search<0, 2>( min_point, max_point ) ), sorted_range( tree.partial_range_search<0, 2>( min_point, max_point ) ) );
+  //Copies are fully built.
+  std::vector<std::tuple<int, int, int>> fresh_input = lazy_input;
+  kd_tree<std::tuple<int, int, int>, std::less<>, lazy_traits> untouched{ fresh_input.begin(), fresh_input.end() };
+  kd_tree<std::tuple<int, int, int>, std::less<>, lazy_traits> copy{ untouched };
+  for( int32_t i = 0; i < copy.size(); ++i ) {
+    EXPECT_EQ( copy[ i ], tree[ i ] );
+  }
+  //Rebuilding defers the construction again, also for trees too small to defer anything.
+  auto small_input = std::vector<std::tuple<int, int, int>>( input_vector.begin(), input_vector.begin() + 3 );
+  lazy_tree.rebuild( small_input.begin(), small_input.end() );
+  EXPECT_EQ( lazy_tree.size(), 3 );
+  EXPECT_EQ( lazy_tree.k_nearest_neighbor( std::make_tuple( 0, 0, 0 ), 5 ).size(), 3u );
+  lazy_tree.rebuild( lazy_input.begin(), lazy_input.end() );
+  auto query = std::make_tuple( 5000, 5000, 5000 );
+  EXPECT_EQ( tree.nearest_neighbor( query ).second, lazy_tree.nearest_neighbor( query ).second );
+  //A hint into a subtree that wasn't built yet is resolved after building it, so the returned point is the one the distance was computed with.
+  for( int32_t index : { 7, 1234, 20011, 49990 } ) {
+    lazy_tree.rebuild( lazy_input.begin(), lazy_input.end() );
+    auto hinted_point = lazy_tree[ index ];
+    auto [ nearest, distance ] = lazy_tree.nearest_neighbor( hinted_point, nearest_neighbor_hint{ index } );
+    EXPECT_EQ( distance, 0u );
+    EXPECT_EQ( nearest, hinted_point );
+  }
+}
+
+TEST( TestKDTree, TestCopyOnWrite ) {
+  counting_allocator counter;
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 5000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 ) );
+  }
+  auto tree = std::make_unique<kd_tree<std::tuple<int, int, int>>>( input_vector.begin(), input_vector.end(), geometricks::default_compare, geometricks::allocator{ counter } );
+  EXPECT_EQ( counter.allocations, 2 );
+  //Copies share the points, even across threads.
+  std::vector<std::thread> threads;
+  std::atomic<int> shared_copies{ 0 };
+  for( int t = 0; t < 4; ++t ) {
+    threads.emplace_back( [ & ]() {
+      for( int i = 0; i < 100; ++i ) {
+        kd_tree<std::tuple<int, int, int>> copy{ *tree };
+        if( &copy[ 0 ] == &( *tree )[ 0 ] ) {
+          ++shared_copies;
+        }
+      }
+    } );
+  }
+  for( auto& thread : threads ) {
+    thread.join();
+  }
+  EXPECT_EQ( shared_copies, 400 );
+  EXPECT_EQ( counter.allocations, 2 );
+  kd_tree<std::tuple<int, int, int>> copy{ *tree };
+  kd_tree<std::tuple<int, int, int>> assigned{ input_vector.begin(), input_vector.begin() + 10 };
+  assigned = copy;
+  EXPECT_EQ( &assigned[ 0 ], &( *tree )[ 0 ] );
+  EXPECT_EQ( assigned.size(), 5000 );
+  //Rebuilding a shared tree gives it its own buffers and leaves the copies untouched.
+  auto query = std::make_tuple( 500, 500, 500 );
+  auto expected = tree->nearest_neighbor( query ).second;
+  std::vector<std::tuple<int, int, int>> far_points( 5000, std::make_tuple( 5000, 5000, 5000 ) );
+  tree->rebuild( far_points.begin(), far_points.end() );
+  EXPECT_EQ( counter.allocations, 4 );
+  EXPECT_NE( &copy[ 0 ], &( *tree )[ 0 ] );
+  EXPECT_EQ( copy.nearest_neighbor( query ).second, expected );
+  EXPECT_EQ( assigned.nearest_neighbor( query ).second, expected );
+  //The shared buffers outlive the tree that created them, and are released with its allocator by the last copy.
+  tree.reset();
+  EXPECT_EQ( counter.live, 2 );
+  EXPECT_EQ( copy.nearest_neighbor( query ).second, expected );
+  //Sole owners rebuild in place again.
+  assigned = kd_tree<std::tuple<int, int, int>>{ far_points.begin(), far_points.begin() + 1 };
+  const std::tuple<int, int, int>* storage = &copy[ 0 ];
+  copy.rebuild( far_points.begin(), far_points.end() );
+  EXPECT_EQ( &copy[ 0 ], storage );
+  EXPECT_EQ( copy.nearest_neighbor( query ).second, dimension::euclidean_distance{}( query, far_points[ 0 ] ) );
+  copy = kd_tree<std::tuple<int, int, int>>{ far_points.begin(), far_points.begin() + 1 };
+  EXPECT_EQ( counter.live, 0 );
+}
+
+TEST( TestKDTree, TestRankedNearestNeighbors ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 ) );
+  }
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  for( int i = 0; i < 50; ++i ) {
+    auto query = std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 );
+    auto expected = tree.k_nearest_neighbor( query, 100 );
+    size_t count = 0;
+    for( auto [ neighbor, distance ] : tree.ranked_nearest_neighbors( query ) ) {
+      EXPECT_EQ( distance, expected[ count ].second );
+      EXPECT_EQ( distance, dimension::euclidean_distance{}( neighbor, query ) );
+      if( ++count == expected.size() ) {
+        break;
+      }
+    }
+    EXPECT_EQ( count, expected.size() );
+  }
+  //Exhausting the iterator visits every point exactly once, in order.
+  auto query = std::make_tuple( 500, 500, 500 );
+  std::vector<const std::tuple<int, int, int>*> visited;
+  auto it = tree.ranked_nearest_neighbors( query ).begin();
+  auto previous_distance = ( *it ).second;
+  for( ; it != tree.ranked_nearest_neighbors( query ).end(); ++it ) {
+    EXPECT_LE( previous_distance, ( *it ).second );
+    previous_distance = ( *it ).second;
+    visited.push_back( &( *it ).first );
+  }
+  EXPECT_EQ( visited.size(), 20000u );
+  std::sort( visited.begin(), visited.end() );
+  EXPECT_EQ( std::unique( visited.begin(), visited.end() ), visited.end() );
+  std::vector<std::tuple<int, int, int>> empty;
+  kd_tree<std::tuple<int, int, int>> empty_tree{ empty.begin(), empty.end() };
+  auto empty_range = empty_tree.ranked_nearest_neighbors( query );
+  EXPECT_TRUE( empty_range.begin() == empty_range.end() );
+}
+
+TEST( TestKDTree, TestLazyRangeSearch ) {
+  std::vector<std::tuple<int, int, int>> input_vector;
+  for( int i = 0; i < 20000; ++i ) {
+    input_vector.push_back( std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 ) );
+  }
+  auto lazy_input = input_vector;
+  kd_tree<std::tuple<int, int, int>> tree{ input_vector.begin(), input_vector.end() };
+  kd_tree<std::tuple<int, int, int>, std::less<>, lazy_traits> lazy_tree{ lazy_input.begin(), lazy_input.end() };
+  for( int i = 0; i < 50; ++i ) {
+    auto min_point = std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 );
+    auto max_point = std::make_tuple( rand() % 1000, rand() % 1000, rand() % 1000 );
+    auto expected = tree.range_search( min_point, max_point );
+    std::vector<std::tuple<int, int, int>> output;
+    for( const auto& point : tree.lazy_range_search( min_point, max_point ) ) {
+      output.push_back( point );
+    }
+    EXPECT_EQ( output, expected );
+    std::vector<std::tuple<int, int, int>> lazy_output;
+    for( const auto& point : lazy_tree.lazy_range_search( min_point, max_point ) ) {
+      lazy_output.push_back( point );
+    }
+    std::sort( expected.begin(), expected.end() );
+    std::sort( lazy_output.begin(), lazy_output.end() );
+    EXPECT_EQ( lazy_output, expected );
+  }
+  //Stopping early yields the first points range_search would return, in the same order.
+  auto early_min = std::make_tuple( 100, 200, 300 );
+  auto early_max = std::make_tuple( 600, 700, 800 );
+  auto early_expected = tree.range_search( early_min, early_max );
+  ASSERT_GE( early_expected.size(), 10u );
+  auto range = tree.lazy_range_search( early_min, early_max );
+  auto it = range.begin();
+  for( size_t i = 0; i < 10; ++i, ++it ) {
+    ASSERT_TRUE( it != range.end() );
+    EXPECT_EQ( *it, early_expected[ i ] );
+  }
+  std::vector<std::tuple<int, int, int>> empty;
+  kd_tree<std::tuple<int, int, int>> empty_tree{ empty.begin(), empty.end() };
+  auto empty_range = empty_tree.lazy_range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 10, 10, 10 ) );
+  EXPECT_TRUE( empty_range.begin() == empty_range.end() );
+}
@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+#include "geometricks/data_structure/kd_tree.hpp"
+#include "geometricks/data_structure/kd_tree_cache.hpp"
+#include <vector>
+#include <tuple>
+#include <array>
+
+using namespace geometricks;
+
+namespace {
+
+  using point_t = std::tuple<int, int, int>;
+
+  std::vector<point_t>
+  make_points( int count, int range ) {
+    std::vector<point_t> points;
+    for( int i = 0; i < count; ++i ) {
+      points.push_back( std::make_tuple( rand() % range, rand() % range, rand() % range ) );
+    }
+    return points;
+  }
+
+}
+
+TEST( TestKDTreeCache, TestExactKey ) {
+  auto points = make_points( 10000, 1000 );
+  kd_tree<point_t> tree{ points.begin(), points.end() };
+  kd_tree_cache cache{ tree, 16 };
+  auto queries = make_points( 8, 1000 );
+  for( int round = 0; round < 3; ++round ) {
+    for( auto& query : queries ) {
+      auto [ nearest, distance ] = cache.nearest_neighbor( query );
+      auto [ expected_nearest, expected_distance ] = tree.nearest_neighbor( query );
+      EXPECT_EQ( &nearest, &expected_nearest );
+      EXPECT_EQ( distance, expected_distance );
+    }
+  }
+  EXPECT_EQ( cache.misses(), 8 );
+  EXPECT_EQ( cache.hits(), 16 );
+  EXPECT_EQ( cache.size(), 8u );
+}
+
+TEST( TestKDTreeCache, TestEviction ) {
+  auto points = make_points( 1000, 1000 );
+  kd_tree<point_t> tree{ points.begin(), points.end() };
+  kd_tree_cache cache{ tree, 2 };
+  auto a = std::make_tuple( 1, 1, 1 );
+  auto b = std::make_tuple( 2, 2, 2 );
+  auto c = std::make_tuple( 3, 3, 3 );
+  cache.nearest_neighbor( a );
+  cache.nearest_neighbor( b );
+  cache.nearest_neighbor( a ); //a is now the most recently used, so c evicts b.
+  cache.nearest_neighbor( c );
+  EXPECT_EQ( cache.size(), 2u );
+  EXPECT_EQ( cache.hits(), 1 );
+  cache.nearest_neighbor( a );
+  EXPECT_EQ( cache.hits(), 2 );
+  cache.nearest_neighbor( b );
+  EXPECT_EQ( cache.hits(), 2 );
+  EXPECT_EQ( cache.misses(), 4 );
+  kd_tree_cache disabled{ tree, 0 };
+  disabled.nearest_neighbor( a );
+  disabled.nearest_neighbor( a );
+  EXPECT_EQ( disabled.misses(), 2 );
+  EXPECT_EQ( disabled.size(), 0u );
+}
+
+TEST( TestKDTreeCache, TestQuantizedKeyAndInvalidation ) {
+  auto points = make_points( 10000, 1000 );
+  kd_tree<point_t> tree{ points.begin(), points.end() };
+  kd_tree_cache cache{ tree, 64, dimension::euclidean_distance{}, quantized_point_key{ std::array<double, 3>{ 10, 10, 10 } } };
+  auto first = cache.nearest_neighbor( std::make_tuple( 501, 502, 503 ) );
+  auto second = cache.nearest_neighbor( std::make_tuple( 509, 505, 500 ) );
+  EXPECT_EQ( &first.first, &second.first );
+  EXPECT_EQ( cache.hits(), 1 );
+  cache.nearest_neighbor( std::make_tuple( 511, 505, 500 ) );
+  EXPECT_EQ( cache.misses(), 2 );
+  auto new_points = make_points( 10000, 1000 );
+  tree.rebuild( new_points.begin(), new_points.end() );
+  auto after_rebuild = cache.nearest_neighbor( std::make_tuple( 501, 502, 503 ) );
+  EXPECT_EQ( cache.misses(), 3 );
+  EXPECT_EQ( cache.size(), 1u );
+  EXPECT_EQ( after_rebuild.second, tree.nearest_neighbor( std::make_tuple( 501, 502, 503 ) ).second );
+}
@@ -0,0 +1,110 @@
+#include "gtest/gtest.h"
+#include "geometricks/data_structure/quantized_kd_tree.hpp"
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace geometricks;
+
+namespace {
+
+  using point_t = std::tuple<float, float, float>;
+
+  std::vector<point_t>
+  make_points( int count, float range ) {
+    std::vector<point_t> points;
+    for( int i = 0; i < count; ++i ) {
+      points.push_back( std::make_tuple( rand() / float( RAND_MAX ) * range, rand() / float( RAND_MAX ) * range, rand() / float( RAND_MAX ) * range ) );
+    }
+    return points;
+  }
+
+  double
+  squared_distance( const point_t& lhs, const point_t& rhs ) {
+    double x = double( std::get<0>( lhs ) ) - std::get<0>( rhs );
+    double y = double( std::get<1>( lhs ) ) - std::get<1>( rhs );
+    double z = double( std::get<2>( lhs ) ) - std::get<2>( rhs );
+    return x * x + y * y + z * z;
+  }
+
+  //Stored points of a quantized tree, recovered with a range search covering everything.
+  template< typename Tree >
+  std::vector<point_t>
+  stored_points( const Tree& tree ) {
+    auto points = tree.range_search( std::make_tuple( -1e9f, -1e9f, -1e9f ), std::make_tuple( 1e9f, 1e9f, 1e9f ) );
+    EXPECT_EQ( static_cast<int32_t>( points.size() ), tree.size() );
+    return points;
+  }
+
+  template< typename Tree >
+  void
+  check_queries( const Tree& tree, float range ) {
+    auto stored = stored_points( tree );
+    for( int i = 0; i < 50; ++i ) {
+      auto query = make_points( 1, range * 1.2f )[ 0 ];
+      std::vector<double> distances;
+      for( auto& point : stored ) {
+        distances.push_back( squared_distance( point, query ) );
+      }
+      std::sort( distances.begin(), distances.end() );
+      auto nearest = tree.k_nearest_neighbor( query, 10 );
+      ASSERT_EQ( nearest.size(), 10u );
+      for( size_t j = 0; j < nearest.size(); ++j ) {
+        EXPECT_DOUBLE_EQ( nearest[ j ].second, distances[ j ] );
+        EXPECT_DOUBLE_EQ( nearest[ j ].second, squared_distance( nearest[ j ].first, query ) );
+      }
+      EXPECT_DOUBLE_EQ( tree.nearest_neighbor( query ).second, distances[ 0 ] );
+      auto min_point = make_points( 1, range )[ 0 ];
+      auto max_point = make_points( 1, range )[ 0 ];
+      std::vector<point_t> expected;
+      for( auto& point : stored ) {
+        bool inside = true;
+        inside = inside && std::get<0>( point ) >= std::min( std::get<0>( min_point ), std::get<0>( max_point ) ) && std::get<0>( point ) <= std::max( std::get<0>( min_point ), std::get<0>( max_point ) );
+        inside = inside && std::get<1>( point ) >= std::min( std::get<1>( min_point ), std::get<1>( max_point ) ) && std::get<1>( point ) <= std::max( std::get<1>( min_point ), std::get<1>( max_point ) );
+        inside = inside && std::get<2>( point ) >= std::min( std::get<2>( min_point ), std::get<2>( max_point ) ) && std::get<2>( point ) <= std::max( std::get<2>( min_point ), std::get<2>( max_point ) );
+        if( inside ) {
+          expected.push_back( point );
+        }
+      }
+      auto output = tree.range_search( min_point, max_point );
+      std::sort( expected.begin(), expected.end() );
+      std::sort( output.begin(), output.end() );
+      EXPECT_EQ( output, expected );
+    }
+  }
+
+}
+
+TEST( TestQuantizedKDTree, TestPrecision ) {
+  auto points = make_points( 20000, 100.f );
+  quantized_kd_tree<point_t> tree{ points.begin(), points.end() };
+  EXPECT_EQ( tree.size(), 20000 );
+  EXPECT_EQ( sizeof( quantized_kd_tree<point_t>::code_type ), 6u );
+  auto error = tree.max_error();
+  for( double value : error ) {
+    EXPECT_LT( value, 100.0 / 65535 );
+  }
+  //Every input point has a stored point within the error bound.
+  for( int i = 0; i < 200; ++i ) {
+    auto [ nearest, distance ] = tree.nearest_neighbor( points[ i ] );
+    EXPECT_LE( std::abs( std::get<0>( nearest ) - std::get<0>( points[ i ] ) ), error[ 0 ] );
+    EXPECT_LE( std::abs( std::get<1>( nearest ) - std::get<1>( points[ i ] ) ), error[ 1 ] );
+    EXPECT_LE( std::abs( std::get<2>( nearest ) - std::get<2>( points[ i ] ) ), error[ 2 ] );
+    ( void ) distance;
+  }
+}
+
+TEST( TestQuantizedKDTree, TestQueriesMatchStoredPoints ) {
+  auto points = make_points( 20000, 100.f );
+  quantized_kd_tree<point_t> tree{ points.begin(), points.end() };
+  check_queries( tree, 100.f );
+  //8 bit codes put many points in the same cell, which the exact refinement has to tell apart.
+  quantized_kd_tree<point_t, uint8_t> coarse_tree{ points.begin(), points.end(), std::make_tuple( 0.f, 0.f, 0.f ), std::make_tuple( 100.f, 100.f, 100.f ) };
+  EXPECT_DOUBLE_EQ( coarse_tree.max_error()[ 0 ], 100.0 / 255 / 2 + 100.0 * std::numeric_limits<float>::epsilon() );
+  check_queries( coarse_tree, 100.f );
+  std::vector<point_t> empty;
+  quantized_kd_tree<point_t> empty_tree{ empty.begin(), empty.end() };
+  EXPECT_TRUE( empty_tree.k_nearest_neighbor( std::make_tuple( 0.f, 0.f, 0.f ), 3 ).empty() );
+  EXPECT_TRUE( empty_tree.range_search( std::make_tuple( 0.f, 0.f, 0.f ), std::make_tuple( 1.f, 1.f, 1.f ) ).empty() );
+}
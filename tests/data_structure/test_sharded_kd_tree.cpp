@@ -0,0 +1,151 @@
+#include "gtest/gtest.h"
+#include "geometricks/data_structure/sharded_kd_tree.hpp"
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <random>
+
+using namespace geometricks;
+
+namespace {
+
+  using point_t = std::tuple<int, int, int>;
+
+  point_t
+  make_point( std::mt19937& generator, int range ) {
+    std::uniform_int_distribution<int> coordinate( 0, range - 1 );
+    int x = coordinate( generator );
+    int y = coordinate( generator );
+    int z = coordinate( generator );
+    return std::make_tuple( x, y, z );
+  }
+
+  std::vector<point_t>
+  make_points( std::mt19937& generator, int count, int range ) {
+    std::vector<point_t> points;
+    for( int i = 0; i < count; ++i ) {
+      points.push_back( make_point( generator, range ) );
+    }
+    return points;
+  }
+
+  std::vector<size_t>
+  brute_force_distances( const std::vector<point_t>& points, const point_t& query ) {
+    std::vector<size_t> distances;
+    for( auto& point : points ) {
+      distances.push_back( dimension::euclidean_distance{}( point, query ) );
+    }
+    std::sort( distances.begin(), distances.end() );
+    return distances;
+  }
+
+}
+
+TEST( TestShardedKDTree, TestQueriesMatchBruteForce ) {
+  std::mt19937 generator{ 41 };
+  auto points = make_points( generator, 30000, 10000 );
+  auto input = points;
+  sharded_kd_tree<point_t> index{ input.begin(), input.end(), 13 };
+  EXPECT_EQ( index.shard_count(), 13 );
+  EXPECT_EQ( index.size(), 30000 );
+  //Points equal to a split go to its right side, so a shard can be short of the even share by the few duplicates of its splits.
+  for( int i = 0; i < index.shard_count(); ++i ) {
+    EXPECT_GE( index.shard( i ).size(), 30000 / 13 - 10 );
+  }
+  for( int i = 0; i < 100; ++i ) {
+    auto query = make_point( generator, 10000 );
+    auto distances = brute_force_distances( points, query );
+    EXPECT_EQ( index.nearest_neighbor( query ).second, distances[ 0 ] );
+    auto nearest = index.k_nearest_neighbor( query, 10 );
+    ASSERT_EQ( nearest.size(), 10u );
+    for( size_t j = 0; j < nearest.size(); ++j ) {
+      EXPECT_EQ( nearest[ j ].second, distances[ j ] );
+    }
+    auto min_point = make_point( generator, 10000 );
+    auto max_point = make_point( generator, 10000 );
+    kd_tree<point_t> reference{ input.begin(), input.end() };
+    auto expected = reference.range_search( min_point, max_point );
+    auto output = index.range_search( min_point, max_point );
+    std::sort( expected.begin(), expected.end() );
+    std::sort( output.begin(), output.end() );
+    EXPECT_EQ( output, expected );
+  }
+  EXPECT_EQ( index.k_nearest_neighbor( std::make_tuple( 0, 0, 0 ), 40000 ).size(), 30000u );
+}
+
+TEST( TestShardedKDTree, TestRebuildShard ) {
+  std::mt19937 generator{ 42 };
+  auto points = make_points( generator, 8000, 1000 );
+  sharded_kd_tree<point_t> index{ points.begin(), points.end(), 8, std::less<>{}, geometricks::allocator{}, 2 };
+  for( auto& point : points ) {
+    EXPECT_LT( index.shard_of( point ), 8 );
+  }
+  //Move the points of a single shard somewhere else and rebuild only that shard.
+  int32_t moved_shard = index.shard_of( points[ 0 ] );
+  std::vector<point_t> moved;
+  for( auto& point : points ) {
+    if( index.shard_of( point ) == moved_shard ) {
+      moved.push_back( std::make_tuple( std::get<0>( point ) + 5000, std::get<1>( point ), std::get<2>( point ) ) );
+    }
+  }
+  std::vector<point_t> all_points;
+  for( auto& point : points ) {
+    if( index.shard_of( point ) != moved_shard ) {
+      all_points.push_back( point );
+    }
+  }
+  //Points equal to a split are routed right both when building and by shard_of, so the selected points are exactly the ones of the shard.
+  ASSERT_EQ( static_cast<int32_t>( moved.size() ), index.shard( moved_shard ).size() );
+  all_points.insert( all_points.end(), moved.begin(), moved.end() );
+  auto moved_input = moved;
+  index.rebuild_shard( moved_shard, moved_input.begin(), moved_input.end() );
+  EXPECT_EQ( index.size(), static_cast<int32_t>( all_points.size() ) );
+  for( int i = 0; i < 100; ++i ) {
+    auto query = make_point( generator, 1000 );
+    std::get<0>( query ) *= 7;
+    auto distances = brute_force_distances( all_points, query );
+    auto nearest = index.k_nearest_neighbor( query, 5 );
+    for( size_t j = 0; j < nearest.size(); ++j ) {
+      EXPECT_EQ( nearest[ j ].second, distances[ j ] );
+    }
+  }
+  EXPECT_EQ( index.range_search( std::make_tuple( 5000, 0, 0 ), std::make_tuple( 7000, 1000, 1000 ) ).size(), moved.size() );
+  std::vector<point_t> empty;
+  index.rebuild( empty.begin(), empty.end() );
+  EXPECT_EQ( index.size(), 0 );
+  EXPECT_TRUE( index.k_nearest_neighbor( std::make_tuple( 0, 0, 0 ), 3 ).empty() );
+  EXPECT_TRUE( index.range_search( std::make_tuple( 0, 0, 0 ), std::make_tuple( 10, 10, 10 ) ).empty() );
+}
+
+namespace {
+
+  struct lazy_traits : kd_tree_traits {
+    static constexpr int32_t lazy_subtree_size = 64;
+  };
+
+}
+
+TEST( TestShardedKDTree, TestLazyShards ) {
+  //Deferred subtrees reorder their points on the first query that enters them, which shouldn't change the bounding boxes of the shards.
+  std::mt19937 generator{ 43 };
+  auto points = make_points( generator, 50000, 10000 );
+  auto input = points;
+  sharded_kd_tree<point_t, std::less<>, lazy_traits> index{ input.begin(), input.end(), 4 };
+  kd_tree<point_t> reference{ points.begin(), points.end() };
+  for( int i = 0; i < 200; ++i ) {
+    auto query = make_point( generator, 10000 );
+    auto expected_nearest = reference.k_nearest_neighbor( query, 10 );
+    auto nearest = index.k_nearest_neighbor( query, 10 );
+    ASSERT_EQ( nearest.size(), expected_nearest.size() );
+    for( size_t j = 0; j < nearest.size(); ++j ) {
+      EXPECT_EQ( nearest[ j ].second, expected_nearest[ j ].second );
+    }
+    auto min_point = make_point( generator, 10000 );
+    auto max_point = make_point( generator, 10000 );
+    auto expected = reference.range_search( min_point, max_point );
+    auto output = index.range_search( min_point, max_point );
+    std::sort( expected.begin(), expected.end() );
+    std::sort( output.begin(), output.end() );
+    EXPECT_EQ( output, expected );
+  }
+}
@@ -0,0 +1,138 @@
+#include "gtest/gtest.h"
+#include "geometricks/data_structure/static_kd_tree.hpp"
+#include <vector>
+#include <array>
+#include <algorithm>
+
+using namespace geometricks;
+
+namespace {
+
+  using point_t = std::array<int, 3>;
+
+  template< size_t N >
+  constexpr std::array<point_t, N>
+  make_points( uint32_t seed ) {
+    std::array<point_t, N> points{};
+    for( auto& point : points ) {
+      for( auto& coordinate : point ) {
+        seed = seed * 1664525u + 1013904223u;
+        coordinate = static_cast<int>( ( seed >> 8 ) % 1000 );
+      }
+    }
+    return points;
+  }
+
+  constexpr auto palette = make_points<512>( 7 );
+
+  constexpr static_kd_tree palette_tree{ palette };
+
+  constexpr size_t
+  count_in_range( const point_t& min_point, const point_t& max_point ) {
+    std::array<point_t, 512> output{};
+    return palette_tree.range_search( min_point, max_point, output.begin() ) - output.begin();
+  }
+
+  constexpr size_t
+  brute_force_count_in_range( const point_t& min_point, const point_t& max_point ) {
+    size_t count = 0;
+    for( auto& point : palette ) {
+      bool inside = true;
+      for( size_t i = 0; i < 3; ++i ) {
+        inside = inside && point[ i ] >= min_point[ i ] && point[ i ] <= max_point[ i ];
+      }
+      count += inside;
+    }
+    return count;
+  }
+
+  constexpr size_t
+  brute_force_nearest_distance( const point_t& query ) {
+    size_t best = meta::numeric_limits<size_t>::max();
+    for( auto& point : palette ) {
+      best = std::min( best, dimension::euclidean_distance{}( point, query ) );
+    }
+    return best;
+  }
+
+  //Every x coordinate is 0 and y only takes 3 values, which made a quickselect without a three way partition quadratic.
+  constexpr auto duplicates = []() {
+    auto points = make_points<1000>( 11 );
+    for( auto& point : points ) {
+      point[ 0 ] = 0;
+      point[ 1 ] %= 3;
+    }
+    return points;
+  }();
+
+  constexpr static_kd_tree duplicates_tree{ duplicates };
+
+  constexpr size_t
+  count_duplicates_in_range( const point_t& min_point, const point_t& max_point ) {
+    std::array<point_t, 1000> output{};
+    return duplicates_tree.range_search( min_point, max_point, output.begin() ) - output.begin();
+  }
+
+  constexpr size_t
+  brute_force_count_duplicates_in_range( const point_t& min_point, const point_t& max_point ) {
+    size_t count = 0;
+    for( auto& point : duplicates ) {
+      bool inside = true;
+      for( size_t i = 0; i < 3; ++i ) {
+        inside = inside && point[ i ] >= min_point[ i ] && point[ i ] <= max_point[ i ];
+      }
+      count += inside;
+    }
+    return count;
+  }
+
+  static_assert( duplicates_tree.nearest_neighbor( duplicates[ 123 ] ).second == 0 );
+  static_assert( count_duplicates_in_range( point_t{ 0, 1, 0 }, point_t{ 0, 1, 999 } ) == brute_force_count_duplicates_in_range( point_t{ 0, 1, 0 }, point_t{ 0, 1, 999 } ) );
+  static_assert( count_duplicates_in_range( point_t{ 0, 0, 0 }, point_t{ 0, 2, 999 } ) == 1000 );
+
+  static_assert( palette_tree.size() == 512 );
+  static_assert( palette_tree.nearest_neighbor( palette[ 17 ] ).second == 0 );
+  static_assert( palette_tree.nearest_neighbor( point_t{ 500, 500, 500 } ).second == brute_force_nearest_distance( point_t{ 500, 500, 500 } ) );
+  static_assert( palette_tree.k_nearest_neighbor<4>( point_t{ 10, 990, 500 } )[ 0 ].second == brute_force_nearest_distance( point_t{ 10, 990, 500 } ) );
+  static_assert( count_in_range( point_t{ 100, 200, 300 }, point_t{ 600, 700, 800 } ) == brute_force_count_in_range( point_t{ 100, 200, 300 }, point_t{ 600, 700, 800 } ) );
+
+}
+
+TEST( TestStaticKDTree, TestRuntimeQueries ) {
+  static const auto points = make_points<3000>( 42 );
+  static const static_kd_tree tree{ points };
+  for( int i = 0; i < 200; ++i ) {
+    point_t query{ rand() % 1000, rand() % 1000, rand() % 1000 };
+    std::vector<size_t> distances;
+    for( auto& point : points ) {
+      distances.push_back( dimension::euclidean_distance{}( point, query ) );
+    }
+    std::sort( distances.begin(), distances.end() );
+    EXPECT_EQ( tree.nearest_neighbor( query ).second, distances[ 0 ] );
+    auto k_nearest = tree.k_nearest_neighbor<8>( query );
+    for( size_t j = 0; j < k_nearest.size(); ++j ) {
+      EXPECT_EQ( k_nearest[ j ].second, distances[ j ] );
+      EXPECT_EQ( dimension::euclidean_distance{}( k_nearest[ j ].first, query ), distances[ j ] );
+    }
+    point_t other{ rand() % 1000, rand() % 1000, rand() % 1000 };
+    std::vector<point_t> in_range;
+    tree.range_search( query, other, std::back_inserter( in_range ) );
+    size_t expected = 0;
+    for( auto& point : points ) {
+      bool inside = true;
+      for( size_t j = 0; j < 3; ++j ) {
+        inside = inside && point[ j ] >= std::min( query[ j ], other[ j ] ) && point[ j ] <= std::max( query[ j ], other[ j ] );
+      }
+      expected += inside;
+    }
+    EXPECT_EQ( in_range.size(), expected );
+  }
+}
+
+TEST( TestStaticKDTree, TestCompileTimeTree ) {
+  //Every stored point is its own nearest neighbor.
+  for( int32_t i = 0; i < palette_tree.size(); ++i ) {
+    EXPECT_EQ( palette_tree.nearest_neighbor( palette_tree[ i ] ).second, 0u );
+  }
+  EXPECT_EQ( count_in_range( point_t{ 0, 0, 0 }, point_t{ 999, 999, 999 } ), 512u );
+}
@@ -0,0 +1,138 @@
+#include "gtest/gtest.h"
+#include "geometricks/data_structure/vp_tree.hpp"
+#include <vector>
+#include <string>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+using namespace geometricks;
+
+namespace {
+
+  struct edit_distance_t {
+    size_t operator()( const std::string& lhs, const std::string& rhs ) const {
+      std::vector<size_t> row( rhs.size() + 1 );
+      for( size_t j = 0; j <= rhs.size(); ++j ) {
+        row[ j ] = j;
+      }
+      for( size_t i = 1; i <= lhs.size(); ++i ) {
+        size_t diagonal = row[ 0 ];
+        row[ 0 ] = i;
+        for( size_t j = 1; j <= rhs.size(); ++j ) {
+          size_t above = row[ j ];
+          row[ j ] = std::min( { row[ j ] + 1, row[ j - 1 ] + 1, diagonal + ( lhs[ i - 1 ] != rhs[ j - 1 ] ) } );
+          diagonal = above;
+        }
+      }
+      return row[ rhs.size() ];
+    }
+  };
+
+  struct euclidean_metric_t {
+    double operator()( const std::array<int, 3>& lhs, const std::array<int, 3>& rhs ) const {
+      double sum = 0;
+      for( size_t i = 0; i < 3; ++i ) {
+        double difference = lhs[ i ] - rhs[ i ];
+        sum += difference * difference;
+      }
+      return std::sqrt( sum );
+    }
+  };
+
+  std::string
+  random_word() {
+    std::string word( 3 + rand() % 6, 'a' );
+    for( auto& character : word ) {
+      character = 'a' + rand() % 4;
+    }
+    return word;
+  }
+
+  std::array<int, 3>
+  random_point() {
+    return { rand() % 10000, rand() % 10000, rand() % 10000 };
+  }
+
+  template< typename T, typename DistanceFunction >
+  std::vector<typename std::decay_t<decltype( std::declval<DistanceFunction>()( std::declval<T>(), std::declval<T>() ) )>>
+  sorted_distances( const std::vector<T>& elements, const T& query, DistanceFunction f ) {
+    std::vector<std::decay_t<decltype( f( query, query ) )>> distances;
+    for( auto& element : elements ) {
+      distances.push_back( f( element, query ) );
+    }
+    std::sort( distances.begin(), distances.end() );
+    return distances;
+  }
+
+}
+
+TEST( TestVPTree, TestEditDistanceQueries ) {
+  std::vector<std::string> words;
+  for( int i = 0; i < 2000; ++i ) {
+    words.push_back( random_word() );
+  }
+  vp_tree<std::string, edit_distance_t> tree{ words.begin(), words.end() };
+  EXPECT_EQ( tree.size(), 2000 );
+  for( int i = 0; i < 100; ++i ) {
+    auto query = random_word();
+    auto expected = sorted_distances( words, query, edit_distance_t{} );
+    auto [ nearest, distance ] = tree.nearest_neighbor( query );
+    EXPECT_EQ( distance, expected[ 0 ] );
+    EXPECT_EQ( edit_distance_t{}( nearest, query ), distance );
+    auto k_nearest = tree.k_nearest_neighbor( query, 7 );
+    ASSERT_EQ( k_nearest.size(), 7u );
+    for( size_t j = 0; j < k_nearest.size(); ++j ) {
+      EXPECT_EQ( k_nearest[ j ].second, expected[ j ] );
+    }
+    auto in_radius = tree.radius_search( query, 2 );
+    EXPECT_EQ( in_radius.size(), static_cast<size_t>( std::upper_bound( expected.begin(), expected.end(), 2u ) - expected.begin() ) );
+    for( auto& [ word, word_distance ] : in_radius ) {
+      EXPECT_LE( word_distance, 2u );
+      EXPECT_EQ( edit_distance_t{}( word, query ), word_distance );
+    }
+  }
+}
+
+TEST( TestVPTree, TestEuclideanQueries ) {
+  std::vector<std::array<int, 3>> points;
+  for( int i = 0; i < 20000; ++i ) {
+    points.push_back( random_point() );
+  }
+  vp_tree<std::array<int, 3>, euclidean_metric_t> tree{ points.begin(), points.end() };
+  for( int i = 0; i < 100; ++i ) {
+    auto query = random_point();
+    auto expected = sorted_distances( points, query, euclidean_metric_t{} );
+    EXPECT_EQ( tree.nearest_neighbor( query ).second, expected[ 0 ] );
+    auto k_nearest = tree.k_nearest_neighbor( query, 10 );
+    ASSERT_EQ( k_nearest.size(), 10u );
+    for( size_t j = 0; j < k_nearest.size(); ++j ) {
+      EXPECT_EQ( k_nearest[ j ].second, expected[ j ] );
+    }
+    auto in_radius = tree.radius_search( query, 500.0 );
+    EXPECT_EQ( in_radius.size(), static_cast<size_t>( std::upper_bound( expected.begin(), expected.end(), 500.0 ) - expected.begin() ) );
+  }
+}
+
+TEST( TestVPTree, TestCopyAndMove ) {
+  std::vector<std::array<int, 3>> points;
+  for( int i = 0; i < 100; ++i ) {
+    points.push_back( random_point() );
+  }
+  vp_tree<std::array<int, 3>, euclidean_metric_t> tree{ points.begin(), points.end() };
+  auto query = random_point();
+  auto expected = tree.k_nearest_neighbor( query, 100 );
+  vp_tree<std::array<int, 3>, euclidean_metric_t> copy{ tree };
+  EXPECT_EQ( copy.k_nearest_neighbor( query, 100 ), expected );
+  vp_tree<std::array<int, 3>, euclidean_metric_t> moved{ std::move( copy ) };
+  EXPECT_EQ( moved.k_nearest_neighbor( query, 100 ), expected );
+  std::vector<std::array<int, 3>> other_points{ random_point() };
+  vp_tree<std::array<int, 3>, euclidean_metric_t> assigned{ other_points.begin(), other_points.end() };
+  assigned = tree;
+  EXPECT_EQ( assigned.k_nearest_neighbor( query, 100 ), expected );
+  EXPECT_EQ( assigned.k_nearest_neighbor( query, 1000 ).size(), 100u );
+  std::vector<std::array<int, 3>> empty;
+  vp_tree<std::array<int, 3>, euclidean_metric_t> empty_tree{ empty.begin(), empty.end() };
+  EXPECT_TRUE( empty_tree.k_nearest_neighbor( query, 3 ).empty() );
+  EXPECT_TRUE( empty_tree.radius_search( query, 10.0 ).empty() );
+}